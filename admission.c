@@ -0,0 +1,183 @@
+#include "program.h"
+
+// Priority class of each known category, in news_categories order;
+// categories we don't know are bulk
+static const NewsPriority category_priority[NUM_CATEGORIES] = {
+    PRIORITY_URGENT,  // BREAKING
+    PRIORITY_NORMAL,  // POLITICS
+    PRIORITY_BULK,    // SPORTS
+    PRIORITY_NORMAL,  // TECHNOLOGY
+    PRIORITY_NORMAL,  // WEATHER
+    PRIORITY_BULK     // ENTERTAINMENT
+};
+
+static const char *priority_names[NUM_PRIORITIES] = {"urgent", "normal", "bulk"};
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+NewsPriority news_priority(uint8_t category){
+    return category < NUM_CATEGORIES ? category_priority[category] : PRIORITY_BULK;
+}
+
+const char *news_priority_name(NewsPriority priority){
+    return priority < NUM_PRIORITIES ? priority_names[priority] : "?";
+}
+
+void admission_init(AdmissionQueue *adm, int process_shared){
+    pthread_mutexattr_t mattr;
+    pthread_condattr_t cattr;
+    pthread_mutexattr_init(&mattr);
+    pthread_condattr_init(&cattr);
+    if(process_shared){
+        pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+        pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    }
+
+    memset(adm, 0, sizeof(*adm));
+    pthread_mutex_init(&adm->lock, &mattr);
+    for(int p = 0; p < NUM_PRIORITIES; p++)
+        pthread_cond_init(&adm->turn[p], &cattr);
+    adm->lanes = 1;
+    adm->favored = -1;
+    pthread_mutexattr_destroy(&mattr);
+    pthread_condattr_destroy(&cattr);
+}
+
+void admission_destroy(AdmissionQueue *adm){
+    for(int p = 0; p < NUM_PRIORITIES; p++)
+        pthread_cond_destroy(&adm->turn[p]);
+    pthread_mutex_destroy(&adm->lock);
+}
+
+static int lane_waiting(const AdmissionQueue *adm, int lane){
+    return adm->next_ticket[lane] != adm->serving[lane];
+}
+
+// Should this lane stand back for another? (caller holds lock)
+static int ahead_waiting(const AdmissionQueue *adm, int lane){
+    if(adm->favored >= 0)
+        return adm->favored != lane;
+    for(int p = 0; p < lane; p++)
+        if(lane_waiting(adm, p))
+            return 1;
+    return 0;
+}
+
+// Wait for this writer's turn. A plain cond wait rather than
+// executor_cond_wait: a worker helping out here could pick up another
+// publisher that queues behind it on the same stack.
+void admission_enter(AdmissionQueue *adm, NewsPriority priority){
+    uint64_t started = now_ns();
+    pthread_mutex_lock(&adm->lock);
+    int lane = adm->lanes ? (int)priority : PRIORITY_NORMAL;
+    uint32_t ticket = adm->next_ticket[lane]++;
+    int queued = 0;
+    while(adm->busy || adm->serving[lane] != ticket || ahead_waiting(adm, lane)){
+        queued = 1;
+        pthread_cond_wait(&adm->turn[lane], &adm->lock);
+    }
+    adm->serving[lane]++;
+    adm->busy = 1;
+    if(adm->favored == lane)
+        adm->favored = -1;
+    adm->bypassed[lane] = 0;
+    for(int p = lane + 1; p < NUM_PRIORITIES; p++)
+        if(lane_waiting(adm, p))
+            adm->bypassed[p]++;
+
+    uint64_t waited = now_ns() - started;
+    adm->admitted[priority]++;
+    adm->queued[priority] += queued;
+    adm->wait_ns[priority] += waited;
+    if(waited > adm->max_wait_ns[priority])
+        adm->max_wait_ns[priority] = waited;
+    pthread_mutex_unlock(&adm->lock);
+}
+
+// Hand the store to the front of the highest-priority lane with a waiter,
+// unless a lower lane has been passed over too often; then it goes first
+void admission_leave(AdmissionQueue *adm){
+    pthread_mutex_lock(&adm->lock);
+    adm->busy = 0;
+    if(adm->favored < 0){
+        for(int p = NUM_PRIORITIES - 1; p > 0; p--){
+            if(lane_waiting(adm, p) && adm->bypassed[p] >= ADMISSION_MAX_BYPASS){
+                adm->favored = p;
+                break;
+            }
+        }
+    }
+    if(adm->favored >= 0){
+        pthread_cond_broadcast(&adm->turn[adm->favored]);
+    }else{
+        for(int p = 0; p < NUM_PRIORITIES; p++){
+            if(lane_waiting(adm, p)){
+                pthread_cond_broadcast(&adm->turn[p]);
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&adm->lock);
+}
+
+void ratelimit_init(RateLimiter *rl, int process_shared){
+    pthread_mutexattr_t mattr;
+    pthread_mutexattr_init(&mattr);
+    if(process_shared)
+        pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    memset(rl, 0, sizeof(*rl));
+    pthread_mutex_init(&rl->lock, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+
+    // Bursts of up to PUBLISH_BURST_SECS worth. Off unless NEWS_PUBLISH_RATE
+    // is set: the demo, agency and importer all publish as writer 0 and
+    // would share one bucket.
+    const char *env = getenv("NEWS_PUBLISH_RATE");
+    double rate = env ? atof(env) : PUBLISH_RATE;
+    ratelimit_set(rl, rate, rate * PUBLISH_BURST_SECS);
+}
+
+// New rate and burst for every publisher; buckets start full again
+void ratelimit_set(RateLimiter *rl, double rate, double burst){
+    pthread_mutex_lock(&rl->lock);
+    rl->rate = rate > 0 ? rate : 0;
+    rl->burst = burst >= 1 ? burst : 1;
+    memset(rl->buckets, 0, sizeof(rl->buckets));
+    pthread_mutex_unlock(&rl->lock);
+}
+
+// Take count tokens from the publisher's bucket, waiting until they are
+// due if it runs short. Tokens are reserved before the wait, so publishers
+// sharing an ID line up instead of all waking at once. On a pool worker the
+// wait runs other tasks rather than parking the thread.
+void ratelimit_acquire(RateLimiter *rl, int publisher, int count){
+    pthread_mutex_lock(&rl->lock);
+    if(rl->rate <= 0){
+        pthread_mutex_unlock(&rl->lock);
+        return;
+    }
+    PublisherBucket *bucket = &rl->buckets[(unsigned)publisher % MAX_PUBLISHERS];
+    uint64_t now = now_ns();
+    if(bucket->last_ns == 0)
+        bucket->tokens = rl->burst;
+    else
+        bucket->tokens += (now - bucket->last_ns) / 1e9 * rl->rate;
+    if(bucket->tokens > rl->burst)
+        bucket->tokens = rl->burst;
+    bucket->last_ns = now;
+    bucket->tokens -= count;
+
+    uint64_t wait_ns = bucket->tokens < 0 ? (uint64_t)(-bucket->tokens / rl->rate * 1e9) : 0;
+    if(wait_ns > 0){
+        rl->throttled++;
+        rl->throttled_ns += wait_ns;
+    }
+    pthread_mutex_unlock(&rl->lock);
+
+    if(wait_ns > 0)
+        executor_sleep(wait_ns);
+}
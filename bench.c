@@ -0,0 +1,1066 @@
+#include "program.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// Benchmarks for the hot paths, run on synthetic stories in memory
+
+static double now_sec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sleep_sec(double seconds){
+    struct timespec ts = {(time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9)};
+    nanosleep(&ts, NULL);
+}
+
+// Deterministic xorshift so every run sees the same stories
+static uint64_t bench_rand(uint64_t *state){
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void random_words(uint64_t *state, char *out, int words){
+    static const char *vocab[] = {
+        "council", "storm", "final", "record", "launch", "market", "vote", "league",
+        "chip", "heatwave", "premiere", "budget", "striker", "update", "outage", "award"
+    };
+    out[0] = '\0';
+    for(int i = 0; i < words; i++){
+        if(i > 0)
+            strcat(out, " ");
+        strcat(out, vocab[bench_rand(state) % 16]);
+    }
+}
+
+// A news file of `stories` lines in save_news_to_file's format. About one
+// line in 500 uses a layout only the fallback parser accepts, and one in
+// 5000 is malformed, so both paths get exercised.
+static char *make_news_text(int stories, size_t *len){
+    size_t cap = (size_t)stories * 160 + 1;
+    char *buf = malloc(cap);
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    time_t when = 1767225600;  // spread over a year of publishing
+    size_t used = 0;
+
+    for(int i = 1; i <= stories; i++){
+        char title[96], content[128], time_str[64];
+        random_words(&state, title, 2 + bench_rand(&state) % 4);
+        random_words(&state, content, 4 + bench_rand(&state) % 8);
+        when += bench_rand(&state) % 60;
+        struct tm tm;
+        localtime_r(&when, &tm);
+
+        if(i % 5000 == 0){
+            used += snprintf(buf + used, cap - used, "%d|%s||%s|%s\n",
+                             i, news_categories[i % NUM_CATEGORIES], content, "not a time");
+            continue;
+        }
+        if(i % 500 == 0)
+            strftime(time_str, sizeof(time_str), "%A %b %e %H:%M:%S %Y", &tm);
+        else
+            strftime(time_str, sizeof(time_str), "%a %b %d %H:%M:%S %Y", &tm);
+        used += snprintf(buf + used, cap - used, "%d|%s|%s|%s|%s\n",
+                         i, news_categories[i % NUM_CATEGORIES], title, content, time_str);
+    }
+    *len = used;
+    return buf;
+}
+
+// Walks the legacy parser over the same text, one story per fast-path story
+typedef struct {
+    FILE *legacy;
+    size_t compared;
+    size_t mismatches;
+} LoaderCheck;
+
+static int next_legacy_story(FILE *file, News *out){
+    char line[1024];
+    while(fgets(line, sizeof(line), file))
+        if(parse_news_line_legacy(line, out) == 0)
+            return 1;
+    return 0;
+}
+
+static void check_story(const News *news_item, void *arg){
+    LoaderCheck *check = (LoaderCheck *)arg;
+    News expected;
+    check->compared++;
+    if(!next_legacy_story(check->legacy, &expected)
+       || expected.id != news_item->id || expected.timestamp != news_item->timestamp
+       || strcmp(expected.category, news_item->category) != 0
+       || strcmp(expected.title, news_item->title) != 0
+       || strcmp(expected.content, news_item->content) != 0){
+        if(check->mismatches++ < 5)
+            printf("Mismatch at story %d\n", news_item->id);
+    }
+}
+
+static void count_story(const News *news_item, void *arg){
+    (void)news_item;
+    (*(size_t *)arg)++;
+}
+
+static int bench_loader(int stories){
+    size_t len;
+    char *text = make_news_text(stories, &len);
+    printf("Loader: %d stories, %.1f MB, %s scanner\n", stories, len / 1e6, loader_scanner_name());
+
+    // Silence the loader's malformed-line messages while timing
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+
+    LoaderCheck check = {fmemopen(text, len, "r"), 0, 0};
+    parse_news_text(text, len, check_story, &check, NULL);
+    News extra;
+    if(next_legacy_story(check.legacy, &extra))
+        check.mismatches++;
+    fclose(check.legacy);
+
+    double t0 = now_sec();
+    FILE *file = fmemopen(text, len, "r");
+    size_t legacy_count = 0;
+    News news_item;
+    while(next_legacy_story(file, &news_item))
+        legacy_count++;
+    fclose(file);
+    double legacy_secs = now_sec() - t0;
+
+    t0 = now_sec();
+    size_t fast_count = 0;
+    parse_news_text(text, len, count_story, &fast_count, NULL);
+    double single_secs = now_sec() - t0;
+
+    NewsDB *db = calloc(1, sizeof(NewsDB));
+    db->store = &db->local_store;
+    t0 = now_sec();
+    load_news_buffer(db, text, len);
+    double parallel_secs = now_sec() - t0;
+
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    close(devnull);
+
+    printf("  legacy sscanf/strptime: %8.2f ms  %6.3f GB/s  (%zu stories)\n",
+           legacy_secs * 1e3, len / legacy_secs / 1e9, legacy_count);
+    printf("  vectorized, 1 thread:   %8.2f ms  %6.3f GB/s  (%zu stories, %.1fx)\n",
+           single_secs * 1e3, len / single_secs / 1e9, fast_count, legacy_secs / single_secs);
+    printf("  vectorized, %d chunks:  %8.2f ms  %6.3f GB/s  (%llu stories, %.1fx)\n",
+           db->last_load.chunks, parallel_secs * 1e3, len / parallel_secs / 1e9,
+           (unsigned long long)db->last_load.stories, legacy_secs / parallel_secs);
+    printf("  validation: %zu stories compared, %zu mismatches\n", check.compared, check.mismatches);
+
+    int ok = check.mismatches == 0 && fast_count == legacy_count && db->last_load.stories == legacy_count;
+    free(db);
+    free(text);
+    return ok ? 0 : 1;
+}
+
+// Best of a few runs, in seconds
+#define SCAN_RUNS 5
+#define SCAN_LOOKUPS 200
+
+// Category filter and ID lookup over `stories` stories, once over an array of
+// whole News structs the way the ring used to be scanned, once with the
+// dense-array kernels the NewsStore uses
+static int bench_scan(int stories){
+    size_t n = (size_t)stories;
+    News *aos = calloc(n, sizeof(News));
+    int *ids = malloc(n * sizeof(int));
+    uint8_t *categories = malloc(n);
+    uint8_t *match = malloc(n);
+    if(!aos || !ids || !categories || !match){
+        perror("Error allocating stories");
+        return 1;
+    }
+
+    uint64_t state = 0x2545f4914f6cdd1dULL;
+    for(size_t i = 0; i < n; i++){
+        int cat = (int)(bench_rand(&state) % NUM_CATEGORIES);
+        aos[i].id = ids[i] = (int)i + 1;
+        snprintf(aos[i].category, sizeof(aos[i].category), "%s", news_categories[cat]);
+        snprintf(aos[i].title, sizeof(aos[i].title), "story %zu", i);
+        categories[i] = (uint8_t)cat;
+    }
+    uint8_t sports = news_category_index("SPORTS");
+    int lookup_ids[SCAN_LOOKUPS];
+    for(int i = 0; i < SCAN_LOOKUPS; i++)
+        lookup_ids[i] = (int)(bench_rand(&state) % n) + 1;
+
+    double aos_filter = 1e9, soa_filter = 1e9, aos_lookup = 1e9, soa_lookup = 1e9;
+    size_t aos_hits = 0, soa_hits = 0;
+    long aos_sum = 0, soa_sum = 0;
+    for(int run = 0; run < SCAN_RUNS; run++){
+        double t0 = now_sec();
+        aos_hits = 0;
+        for(size_t i = 0; i < n; i++){
+            match[i] = strcmp(aos[i].category, "SPORTS") == 0;
+            aos_hits += match[i];
+        }
+        double t1 = now_sec();
+        soa_hits = scan_category(categories, n, sports, match);
+        double t2 = now_sec();
+
+        aos_sum = 0;
+        for(int k = 0; k < SCAN_LOOKUPS; k++){
+            for(size_t i = 0; i < n; i++){
+                if(aos[i].id == lookup_ids[k]){
+                    aos_sum += (long)i;
+                    break;
+                }
+            }
+        }
+        double t3 = now_sec();
+        soa_sum = 0;
+        for(int k = 0; k < SCAN_LOOKUPS; k++)
+            soa_sum += scan_find_id(ids, n, 0, lookup_ids[k]);
+        double t4 = now_sec();
+
+        if(t1 - t0 < aos_filter) aos_filter = t1 - t0;
+        if(t2 - t1 < soa_filter) soa_filter = t2 - t1;
+        if(t3 - t2 < aos_lookup) aos_lookup = t3 - t2;
+        if(t4 - t3 < soa_lookup) soa_lookup = t4 - t3;
+    }
+
+    printf("Scan: %d stories, News is %zu bytes, hot metadata %zu bytes per story\n",
+           stories, sizeof(News), sizeof(int) + sizeof(uint8_t) + sizeof(time_t));
+    printf("  category filter  AoS strcmp: %8.2f ms  (%.2f ns/story, %zu hits)\n",
+           aos_filter * 1e3, aos_filter * 1e9 / n, aos_hits);
+    printf("  category filter  SoA enum:   %8.2f ms  (%.2f ns/story, %zu hits, %.1fx)\n",
+           soa_filter * 1e3, soa_filter * 1e9 / n, soa_hits, aos_filter / soa_filter);
+    printf("  %d id lookups   AoS:        %8.2f ms  (%.2f us/lookup)\n",
+           SCAN_LOOKUPS, aos_lookup * 1e3, aos_lookup * 1e6 / SCAN_LOOKUPS);
+    printf("  %d id lookups   SoA:        %8.2f ms  (%.2f us/lookup, %.1fx)\n",
+           SCAN_LOOKUPS, soa_lookup * 1e3, soa_lookup * 1e6 / SCAN_LOOKUPS, aos_lookup / soa_lookup);
+
+    int ok = aos_hits == soa_hits && aos_sum == soa_sum;
+    if(!ok)
+        printf("  MISMATCH between layouts\n");
+    free(aos);
+    free(ids);
+    free(categories);
+    free(match);
+    return ok ? 0 : 1;
+}
+
+// Stories in the ring, oldest first; returns how many
+static int copy_ring(NewsDB *db, News *out){
+    for(int i = 0; i < db->num_news; i++)
+        store_get(db->store, (db->start + i) % MAX_NEWS, &out[i]);
+    return db->num_news;
+}
+
+static int same_ring(NewsDB *db, const News *expected, int count){
+    News ring[MAX_NEWS];
+    if(copy_ring(db, ring) != count)
+        return 0;
+    for(int i = 0; i < count; i++){
+        if(ring[i].id != expected[i].id || ring[i].timestamp != expected[i].timestamp
+           || strcmp(ring[i].category, expected[i].category) != 0
+           || strcmp(ring[i].title, expected[i].title) != 0
+           || strcmp(ring[i].content, expected[i].content) != 0)
+            return 0;
+    }
+    return 1;
+}
+
+// Startup on a news file of `stories` lines: replaying all of it, restoring
+// a checkpoint that covers all of it, and restoring one with 1% of the file
+// appended after it. Runs in a scratch directory.
+static int bench_checkpoint(int stories){
+    char dir[] = "/tmp/newsbench.XXXXXX";
+    char cwd[512];
+    if(!getcwd(cwd, sizeof(cwd)) || !mkdtemp(dir) || chdir(dir) < 0){
+        perror("Error creating scratch directory");
+        return 1;
+    }
+
+    size_t len, tail_len;
+    char *text = make_news_text(stories, &len);
+    char *tail = make_news_text(stories / 100 + 1, &tail_len);
+    FILE *file = fopen(NEWS_FILE, "w");
+    fwrite(text, 1, len, file);
+    fclose(file);
+
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+
+    NewsDB *db = calloc(1, sizeof(NewsDB));
+    News expected[MAX_NEWS];
+    double t0 = now_sec();
+    init_news_db(db);
+    double full_secs = now_sec() - t0;
+    int count = copy_ring(db, expected);
+    close_news_db(db);  // leaves a checkpoint covering the whole file
+
+    t0 = now_sec();
+    init_news_db(db);
+    double restore_secs = now_sec() - t0;
+    int restore_ok = same_ring(db, expected, count);
+    close_news_db(db);
+
+    file = fopen(NEWS_FILE, "a");
+    fwrite(tail, 1, tail_len, file);
+    fclose(file);
+    t0 = now_sec();
+    init_news_db(db);
+    double tail_secs = now_sec() - t0;
+    count = copy_ring(db, expected);
+    close_news_db(db);
+    remove(CHECKPOINT_FILE);
+    init_news_db(db);
+    int tail_ok = same_ring(db, expected, count);
+    close_news_db(db);
+
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    close(devnull);
+
+    printf("Startup: %d stories, %.1f MB news file\n", stories, len / 1e6);
+    printf("  full replay:                 %8.2f ms\n", full_secs * 1e3);
+    printf("  checkpoint, no tail:         %8.2f ms  (%.0fx, ring %s)\n",
+           restore_secs * 1e3, full_secs / restore_secs, restore_ok ? "matches" : "DIFFERS");
+    printf("  checkpoint + %4.1f MB tail:   %8.2f ms  (%.0fx, ring %s)\n",
+           tail_len / 1e6, tail_secs * 1e3, full_secs / tail_secs, tail_ok ? "matches" : "DIFFERS");
+
+    const char *files[] = {NEWS_FILE, NEWS_FILE ".tmp", CHECKPOINT_FILE, CHECKPOINT_FILE ".tmp", CATEGORY_FILE};
+    for(size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+        remove(files[i]);
+    if(chdir(cwd) < 0)
+        perror("Error leaving scratch directory");
+    rmdir(dir);
+    free(db);
+    free(text);
+    free(tail);
+    return restore_ok && tail_ok ? 0 : 1;
+}
+
+#define TREND_THREADS 4
+
+typedef struct {
+    TrendTable *trend;
+    pthread_mutex_t *lock;
+    long reads;
+} TrendWorker;
+
+// Reads in listings of MAX_NEWS stories, taking the epoch once per listing
+// like show_all_news does, and the lock too when readers share the table
+static void *trend_worker(void *arg){
+    TrendWorker *w = (TrendWorker *)arg;
+    for(long i = 0; i < w->reads; i += MAX_NEWS){
+        if(w->lock)
+            pthread_mutex_lock(w->lock);
+        uint32_t epoch = trend_epoch();
+        for(long j = i; j < i + MAX_NEWS && j < w->reads; j++)
+            trend_record(w->trend, (int)(j % MAX_NEWS), epoch);
+        if(w->lock)
+            pthread_mutex_unlock(w->lock);
+    }
+    return NULL;
+}
+
+// Cost trend_record adds to every read alone, and with readers in parallel
+// each taking the store lock per listing as the real read paths do
+static int bench_trend(long reads){
+    TrendTable *trend = calloc(1, sizeof(TrendTable));
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    TrendWorker w = {trend, NULL, reads};
+
+    double t0 = now_sec();
+    trend_worker(&w);
+    double single = now_sec() - t0;
+
+    pthread_t threads[TREND_THREADS];
+    TrendWorker workers[TREND_THREADS];
+    t0 = now_sec();
+    for(int i = 0; i < TREND_THREADS; i++){
+        workers[i].trend = trend;
+        workers[i].lock = &lock;
+        workers[i].reads = reads;
+        pthread_create(&threads[i], NULL, trend_worker, &workers[i]);
+    }
+    for(int i = 0; i < TREND_THREADS; i++)
+        pthread_join(threads[i], NULL);
+    double parallel = now_sec() - t0;
+
+    uint64_t total = 0;
+    for(int slot = 0; slot < MAX_NEWS; slot++)
+        total += trend_reads(trend, slot, TREND_BUCKETS);
+
+    printf("Trend counters: %ld reads per thread\n", reads);
+    printf("  1 thread:  %6.2f ns/read\n", single * 1e9 / reads);
+    printf("  %d threads: %6.2f ns/read overall, listing lock included (wall %.2f ms)\n",
+           TREND_THREADS, parallel * 1e9 / ((double)reads * TREND_THREADS), parallel * 1e3);
+
+    // Every read must be counted, even across a bucket boundary
+    uint64_t expected = (uint64_t)reads * (TREND_THREADS + 1);
+    printf("  counted %llu of %llu reads\n", (unsigned long long)total, (unsigned long long)expected);
+    free(trend);
+    return total == expected ? 0 : 1;
+}
+
+#define BULK_PUBLISHERS 4
+#define URGENT_EVERY_MS 5
+#define MAX_URGENT_SAMPLES 4096
+
+typedef struct {
+    NewsDB *db;
+    int publisher;
+    volatile int *stop;
+    uint64_t published;
+    uint64_t samples[MAX_URGENT_SAMPLES];  // urgent publisher's latencies, ns
+    int num_samples;
+} PublishWorker;
+
+// Bulk publisher: entertainment and sports stories back to back
+static void *bulk_publisher(void *arg){
+    PublishWorker *w = (PublishWorker *)arg;
+    char title[64];
+    while(!*w->stop){
+        snprintf(title, sizeof(title), "Bulk %d story %llu", w->publisher, (unsigned long long)w->published);
+        add_news(w->db, w->published % 2 ? "SPORTS" : "ENTERTAINMENT", title, "Filler copy", w->publisher);
+        w->published++;
+    }
+    return NULL;
+}
+
+// BREAKING publisher: a story every URGENT_EVERY_MS, timing each from the
+// add_news call to the point it is in the ring for readers
+static void *urgent_publisher(void *arg){
+    PublishWorker *w = (PublishWorker *)arg;
+    char title[64];
+    while(!*w->stop && w->num_samples < MAX_URGENT_SAMPLES){
+        snprintf(title, sizeof(title), "Breaking story %d", w->num_samples);
+        double t0 = now_sec();
+        add_news(w->db, "BREAKING", title, "Details to follow", w->publisher);
+        w->samples[w->num_samples++] = (uint64_t)((now_sec() - t0) * 1e9);
+        w->published++;
+        sleep_sec(URGENT_EVERY_MS / 1e3);
+    }
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b){
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// One saturation run; prints BREAKING latency percentiles and returns the
+// p99 in ns
+static uint64_t priority_run(const char *label, int lanes, double rate, double seconds){
+    NewsDB *db = calloc(1, sizeof(NewsDB));
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+
+    init_news_db(db);
+    db->admission.lanes = lanes;
+    ratelimit_set(&db->limits, rate, rate * PUBLISH_BURST_SECS);
+
+    volatile int stop = 0;
+    pthread_t threads[BULK_PUBLISHERS + 1];
+    PublishWorker *workers = calloc(BULK_PUBLISHERS + 1, sizeof(PublishWorker));
+    for(int i = 0; i <= BULK_PUBLISHERS; i++){
+        workers[i].db = db;
+        workers[i].publisher = i + 1;
+        workers[i].stop = &stop;
+        pthread_create(&threads[i], NULL, i == 0 ? urgent_publisher : bulk_publisher, &workers[i]);
+    }
+    sleep_sec(seconds);
+    stop = 1;
+    uint64_t bulk = 0;
+    for(int i = 0; i <= BULK_PUBLISHERS; i++){
+        pthread_join(threads[i], NULL);
+        if(i > 0)
+            bulk += workers[i].published;
+    }
+    int urgent_kept = 0;
+    for(int i = 0; i < db->num_news; i++)
+        urgent_kept += news_priority(db->store->category[(db->start + i) % MAX_NEWS]) == PRIORITY_URGENT;
+    close_news_db(db);
+
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    close(devnull);
+
+    PublishWorker *u = &workers[0];
+    qsort(u->samples, u->num_samples, sizeof(uint64_t), compare_u64);
+    uint64_t p50 = u->num_samples ? u->samples[u->num_samples / 2] : 0;
+    uint64_t p99 = u->num_samples ? u->samples[u->num_samples * 99 / 100] : 0;
+    uint64_t max = u->num_samples ? u->samples[u->num_samples - 1] : 0;
+    printf("  %-22s p50 %8.1f us  p99 %8.1f us  max %8.1f us  (%d breaking, %d/%d still in buffer; %.0f bulk/s)\n",
+           label, p50 / 1e3, p99 / 1e3, max / 1e3, u->num_samples,
+           urgent_kept, MAX_NEWS, bulk / seconds);
+    free(workers);
+    free(db);
+    return p99;
+}
+
+// BREAKING publish-to-visible latency while BULK_PUBLISHERS publishers
+// flood the store, with one FIFO admission lane, with priority lanes, and
+// with lanes plus per-publisher rate limits. Runs in a scratch directory.
+static int bench_priority(double seconds){
+    char dir[] = "/tmp/newsbench.XXXXXX";
+    char cwd[512];
+    if(!getcwd(cwd, sizeof(cwd)) || !mkdtemp(dir) || chdir(dir) < 0){
+        perror("Error creating scratch directory");
+        return 1;
+    }
+
+    printf("BREAKING latency, %d bulk publishers flat out, %.1f s per run\n", BULK_PUBLISHERS, seconds);
+    uint64_t fifo = priority_run("one FIFO lane:", 0, 0, seconds);
+    uint64_t lanes = priority_run("priority lanes:", 1, 0, seconds);
+    priority_run("lanes + 200/s limit:", 1, 200, seconds);
+    printf("  p99 with lanes: %.1fx lower\n", lanes ? (double)fifo / lanes : 0.0);
+
+    const char *files[] = {NEWS_FILE, NEWS_FILE ".tmp", CHECKPOINT_FILE, CHECKPOINT_FILE ".tmp", CATEGORY_FILE};
+    for(size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+        remove(files[i]);
+    if(chdir(cwd) < 0)
+        perror("Error leaving scratch directory");
+    rmdir(dir);
+    return 0;
+}
+
+// Lines in the news file, which should hold exactly the buffer
+static int count_file_lines(void){
+    FILE *file = fopen(NEWS_FILE, "r");
+    int lines = 0, c;
+    if(!file)
+        return -1;
+    while((c = fgetc(file)) != EOF)
+        lines += c == '\n';
+    fclose(file);
+    return lines;
+}
+
+// Publish `stories` stories one add_news at a time, then the same number
+// through add_news_batch in IMPORT_BATCH batches, each into a fresh store
+static double batch_run(int stories, int batched, int *file_ok){
+    remove(NEWS_FILE);
+    remove(CHECKPOINT_FILE);
+    NewsDB *db = calloc(1, sizeof(NewsDB));
+    init_news_db(db);
+    ratelimit_set(&db->limits, 0, 0);
+
+    static char titles[IMPORT_BATCH][64];
+    NewsDraft drafts[IMPORT_BATCH];
+    int ids[IMPORT_BATCH];
+    double t0 = now_sec();
+    for(int done = 0; done < stories; ){
+        int n = stories - done < IMPORT_BATCH ? stories - done : IMPORT_BATCH;
+        for(int i = 0; i < n; i++){
+            snprintf(titles[i], sizeof(titles[i]), "Wire story %d", done + i);
+            drafts[i].category = news_categories[(done + i) % NUM_CATEGORIES];
+            drafts[i].title = titles[i];
+            drafts[i].content = "Copy from the wire";
+        }
+        if(batched){
+            add_news_batch(db, drafts, n, ids, 1);
+        }else{
+            for(int i = 0; i < n; i++)
+                add_news(db, drafts[i].category, drafts[i].title, drafts[i].content, 1);
+        }
+        done += n;
+    }
+    double secs = now_sec() - t0;
+
+    wait_news_durable(db);
+    *file_ok = count_file_lines() == db->num_news;
+    close_news_db(db);
+    free(db);
+    return secs;
+}
+
+static int bench_batch(int stories){
+    char dir[] = "/tmp/newsbench.XXXXXX";
+    char cwd[512];
+    if(!getcwd(cwd, sizeof(cwd)) || !mkdtemp(dir) || chdir(dir) < 0){
+        perror("Error creating scratch directory");
+        return 1;
+    }
+
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    int single_ok, batch_ok;
+    double single = batch_run(stories, 0, &single_ok);
+    double batched = batch_run(stories, 1, &batch_ok);
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    close(devnull);
+
+    printf("Publishing %d stories\n", stories);
+    printf("  add_news one by one:      %8.2f ms  (%.0f stories/s, file %s)\n",
+           single * 1e3, stories / single, single_ok ? "matches buffer" : "DIFFERS");
+    printf("  add_news_batch of %d:     %8.2f ms  (%.0f stories/s, file %s, %.1fx)\n",
+           IMPORT_BATCH, batched * 1e3, stories / batched, batch_ok ? "matches buffer" : "DIFFERS",
+           single / batched);
+
+    const char *files[] = {NEWS_FILE, NEWS_FILE ".tmp", CHECKPOINT_FILE, CHECKPOINT_FILE ".tmp", CATEGORY_FILE};
+    for(size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+        remove(files[i]);
+    if(chdir(cwd) < 0)
+        perror("Error leaving scratch directory");
+    rmdir(dir);
+    return single_ok && batch_ok ? 0 : 1;
+}
+
+// Time `reads` listings alternating all news and one category; a story is
+// published before every `write_every` reads (0: never). With render_always
+// the cache is invalidated before each read, which costs what the listings
+// did before they were cached. Returns the average read time in seconds.
+static double listing_run(NewsDB *db, long reads, int write_every, int render_always){
+    double read_secs = 0;
+    char title[64];
+    for(long i = 0; i < reads; i++){
+        if(write_every > 0 && i % write_every == 0){
+            snprintf(title, sizeof(title), "Update %ld", i);
+            add_news(db, news_categories[i % NUM_CATEGORIES], title, "Fresh copy", 1);
+        }
+        if(render_always){
+            pthread_mutex_lock(&db->lock);
+            listing_invalidate_all(&db->listings);
+            pthread_mutex_unlock(&db->lock);
+        }
+        double t0 = now_sec();
+        if(i % 2)
+            show_all_news(db);
+        else
+            show_news_by_category(db, news_categories[(i / 2) % NUM_CATEGORIES]);
+        read_secs += now_sec() - t0;
+    }
+    return read_secs / reads;
+}
+
+static int bench_listing(long reads){
+    char dir[] = "/tmp/newsbench.XXXXXX";
+    char cwd[512];
+    if(!getcwd(cwd, sizeof(cwd)) || !mkdtemp(dir) || chdir(dir) < 0){
+        perror("Error creating scratch directory");
+        return 1;
+    }
+
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+
+    NewsDB *db = calloc(1, sizeof(NewsDB));
+    init_news_db(db);
+    ratelimit_set(&db->limits, 0, 0);
+    static char titles[WARN_THRESHOLD][64];
+    NewsDraft drafts[WARN_THRESHOLD];
+    int ids[WARN_THRESHOLD];
+    for(int i = 0; i < WARN_THRESHOLD; i++){
+        snprintf(titles[i], sizeof(titles[i]), "Listing story %d", i);
+        drafts[i].category = news_categories[i % NUM_CATEGORIES];
+        drafts[i].title = titles[i];
+        drafts[i].content = "A paragraph of copy long enough to look like a real story body.";
+    }
+    add_news_batch(db, drafts, WARN_THRESHOLD, ids, 1);
+
+    double rendered = listing_run(db, reads, 0, 1);
+    uint64_t hits0 = db->listings.hits, misses0 = db->listings.misses;
+    double cached = listing_run(db, reads, 0, 0);
+    uint64_t hits1 = db->listings.hits, misses1 = db->listings.misses;
+    double mixed = listing_run(db, reads, 50, 0);
+    uint64_t hits2 = db->listings.hits, misses2 = db->listings.misses;
+    close_news_db(db);
+    free(db);
+
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    close(devnull);
+
+    printf("Listings of %d stories, %ld reads each run\n", WARN_THRESHOLD, reads);
+    printf("  render every read:         %7.2f us/read\n", rendered * 1e6);
+    printf("  cached, no writes:         %7.2f us/read  (%.1fx, hit rate %.1f%%)\n",
+           cached * 1e6, rendered / cached, 100.0 * (hits1 - hits0) / ((hits1 - hits0) + (misses1 - misses0)));
+    printf("  cached, 1 publish/50 reads:%7.2f us/read  (%.1fx, hit rate %.1f%%)\n",
+           mixed * 1e6, rendered / mixed, 100.0 * (hits2 - hits1) / ((hits2 - hits1) + (misses2 - misses1)));
+
+    const char *files[] = {NEWS_FILE, NEWS_FILE ".tmp", CHECKPOINT_FILE, CHECKPOINT_FILE ".tmp", CATEGORY_FILE};
+    for(size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+        remove(files[i]);
+    if(chdir(cwd) < 0)
+        perror("Error leaving scratch directory");
+    rmdir(dir);
+    return 0;
+}
+
+typedef struct {
+    NewsDB *db;
+    int feed;
+    int stories;
+    uint64_t *published;  // by story ID, taken just before add_news
+    uint64_t *samples;
+    int count;
+} LatencyReader;
+
+// Subscriber: takes every delivery off its queue and reads the story
+static void *latency_reader(void *arg){
+    LatencyReader *r = (LatencyReader *)arg;
+    StoryRef ref;
+    News news_item;
+    while(r->count < r->stories && fanout_next(&r->db->fanout, r->feed, &ref, 1000) > 0){
+        if(read_story_ref(r->db, ref, &news_item) && ref.id < r->stories + 1)
+            r->samples[r->count] = latency_now_ns() - r->published[ref.id];
+        r->count++;
+    }
+    return NULL;
+}
+
+// Publish `stories` stories 200 us apart to one blocking subscriber, then
+// compare the BREAKING histogram's percentiles with the exact ones the
+// subscriber measured itself, and time latency_record on its own
+static int bench_latency(int stories){
+    char dir[] = "/tmp/newsbench.XXXXXX";
+    char cwd[512];
+    if(!getcwd(cwd, sizeof(cwd)) || !mkdtemp(dir) || chdir(dir) < 0){
+        perror("Error creating scratch directory");
+        return 1;
+    }
+
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+
+    NewsDB *db = calloc(1, sizeof(NewsDB));
+    init_news_db(db);
+    ratelimit_set(&db->limits, 0, 0);
+    LatencyReader r = {db, fanout_subscribe(&db->fanout, OVERFLOW_BLOCK), stories,
+                       calloc(stories + 1, sizeof(uint64_t)), calloc(stories, sizeof(uint64_t)), 0};
+    pthread_t reader;
+    pthread_create(&reader, NULL, latency_reader, &r);
+    char title[64];
+    for(int i = 1; i <= stories; i++){
+        snprintf(title, sizeof(title), "Latency story %d", i);
+        r.published[i] = latency_now_ns();
+        add_news(db, "BREAKING", title, "Timing copy", 1);
+        sleep_sec(200e-6);
+    }
+    pthread_join(reader, NULL);
+    LatencyHistogram hist = db->latency.by_category[0];
+    fanout_unsubscribe(&db->fanout, r.feed);
+    close_news_db(db);
+
+    LatencyHistogram *scratch = calloc(1, sizeof(LatencyHistogram));
+    const long records = 10000000;
+    double t0 = now_sec();
+    for(long i = 0; i < records; i++)
+        latency_record(scratch, (uint64_t)i * 7919 % 50000000);
+    double record_ns = (now_sec() - t0) * 1e9 / records;
+
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    close(devnull);
+
+    qsort(r.samples, r.count, sizeof(uint64_t), compare_u64);
+    printf("Publish-to-read, %d BREAKING stories to one subscriber (%llu recorded)\n",
+           r.count, (unsigned long long)hist.total);
+    double worst = 0;
+    const double ps[] = {0.50, 0.90, 0.99, 0.999};
+    for(int i = 0; i < 4; i++){
+        double exact = r.count ? r.samples[(size_t)(ps[i] * (r.count - 1))] / 1e3 : 0;
+        double approx = latency_percentile(&hist, ps[i]) / 1e3;
+        double err = exact > 0 ? (approx - exact) / exact * 100 : 0;
+        if(err < 0)
+            err = -err;
+        if(err > worst)
+            worst = err;
+        printf("  p%-5g histogram %9.1f us   exact %9.1f us\n", ps[i] * 100, approx, exact);
+    }
+    printf("  worst percentile error %.1f%%, latency_record %.1f ns\n", worst, record_ns);
+
+    const char *files[] = {NEWS_FILE, NEWS_FILE ".tmp", CHECKPOINT_FILE, CHECKPOINT_FILE ".tmp", CATEGORY_FILE};
+    for(size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+        remove(files[i]);
+    if(chdir(cwd) < 0)
+        perror("Error leaving scratch directory");
+    rmdir(dir);
+    free(db);
+    free(scratch);
+    free(r.published);
+    free(r.samples);
+    return hist.total == (uint64_t)stories ? 0 : 1;
+}
+
+// What a follower process saw, sent back over a pipe
+typedef struct {
+    uint64_t lsn;
+    uint64_t records;
+    uint64_t snapshots;
+    uint64_t superseded;
+    uint64_t max_behind;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t max_ns;
+    uint64_t ring_hash;
+    double catch_up_ms;  // from starting up to having the target record
+} FollowerReport;
+
+static uint64_t ring_hash(NewsDB *db){
+    pthread_mutex_lock(&db->lock);
+    size_t len;
+    char *buf = format_news_snapshot(db, &len);
+    pthread_mutex_unlock(&db->lock);
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for(size_t i = 0; buf && i < len; i++)
+        h = (h ^ (unsigned char)buf[i]) * 0x100000001b3ULL;
+    free(buf);
+    return h;
+}
+
+// Follower process. Forked before the primary starts any threads; waits
+// for a go, opens the database in dir (its checkpoint and log from a
+// previous run, if any), follows sock until it has the record it is then
+// told to reach, and reports back.
+static void follower_child(const char *dir, const char *sock, int cmd_fd, int report_fd){
+    uint64_t target;
+    if(read(cmd_fd, &target, sizeof(target)) != sizeof(target) || chdir(dir) < 0)
+        _exit(1);
+    double t0 = now_sec();
+    NewsDB *db = calloc(1, sizeof(NewsDB));
+    init_news_db(db);
+    if(replica_follow(db, sock) < 0 || read(cmd_fd, &target, sizeof(target)) != sizeof(target))
+        _exit(1);
+    while(__atomic_load_n(&db->replica_lsn, __ATOMIC_RELAXED) < target)
+        sleep_sec(50e-6);
+
+    FollowerReport rep;
+    rep.catch_up_ms = (now_sec() - t0) * 1e3;
+    rep.lsn = db->replica_lsn;
+    rep.ring_hash = ring_hash(db);
+    ReplicaFollower *rf = db->follower;
+    pthread_mutex_lock(&rf->lock);
+    rep.records = rf->applied;
+    rep.snapshots = rf->snapshots;
+    rep.superseded = rf->superseded;
+    rep.max_behind = rf->max_behind;
+    rep.p50_ns = latency_percentile(&rf->lag, 0.50);
+    rep.p99_ns = latency_percentile(&rf->lag, 0.99);
+    rep.max_ns = rf->lag.max_ns;
+    pthread_mutex_unlock(&rf->lock);
+    close_news_db(db);
+    executor_shutdown(executor_default());
+    _exit(write(report_fd, &rep, sizeof(rep)) == sizeof(rep) ? 0 : 1);
+}
+
+static void publish_stories(NewsDB *db, int from, int count, double gap){
+    char title[64];
+    for(int i = from; i < from + count; i++){
+        snprintf(title, sizeof(title), "Replicated story %d", i);
+        add_news(db, news_categories[i % NUM_CATEGORIES], title, "Shipped copy", 1 + i % 4);
+        if(gap > 0)
+            sleep_sec(gap);
+    }
+}
+
+static uint64_t primary_lsn(NewsDB *db){
+    pthread_mutex_lock(&db->primary->lock);
+    uint64_t lsn = db->primary->lsn;
+    pthread_mutex_unlock(&db->primary->lock);
+    return lsn;
+}
+
+// Tell follower child i to start (and where to get to, if known), then
+// wait for its report
+static int run_follower(pid_t *pids, int *cmd, int *report, int i, uint64_t target, int live, NewsDB *db,
+                        int stories, FollowerReport *rep){
+    uint64_t go = 1;
+    if(write(cmd[i], &go, sizeof(go)) != sizeof(go))
+        return -1;
+    if(live){
+        // Wait for the follower's opening snapshot, then publish while it streams
+        int synced = 0;
+        while(!synced){
+            sleep_sec(1e-3);
+            pthread_mutex_lock(&db->primary->lock);
+            synced = db->primary->links[0].active && db->primary->links[0].snapshots > 0;
+            pthread_mutex_unlock(&db->primary->lock);
+        }
+        publish_stories(db, 1, stories, 200e-6);
+        target = primary_lsn(db);
+    }
+    int status;
+    if(write(cmd[i], &target, sizeof(target)) != sizeof(target)
+       || read(report[i], rep, sizeof(*rep)) != sizeof(*rep) || waitpid(pids[i], &status, 0) < 0)
+        return -1;
+    return status == 0 ? 0 : -1;
+}
+
+// One primary and, one after another, three runs of a follower process in
+// another directory: streaming `stories` published 200 us apart; restarting after 100 more
+// were published (checkpoint, local log, then the primary's backlog); and
+// restarting after more than a backlog's worth (snapshot)
+static int bench_replication(int stories){
+    char dir[] = "/tmp/newsbench.XXXXXX";
+    char cwd[512], primary_dir[600], follower_dir[600], sock[600];
+    if(!getcwd(cwd, sizeof(cwd)) || !mkdtemp(dir)){
+        perror("Error creating scratch directory");
+        return 1;
+    }
+    snprintf(primary_dir, sizeof(primary_dir), "%s/primary", dir);
+    snprintf(follower_dir, sizeof(follower_dir), "%s/follower", dir);
+    snprintf(sock, sizeof(sock), "%s/sock", dir);
+    if(mkdir(primary_dir, 0755) < 0 || mkdir(follower_dir, 0755) < 0 || chdir(primary_dir) < 0){
+        perror("Error creating scratch directory");
+        return 1;
+    }
+
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+
+    const int runs = 3;
+    pid_t pids[3];
+    int cmd[3], report[3];
+    for(int i = 0; i < runs; i++){
+        int cmd_pipe[2], report_pipe[2];
+        if(pipe(cmd_pipe) < 0 || pipe(report_pipe) < 0 || (pids[i] = fork()) < 0){
+            perror("Error starting follower");
+            return 1;
+        }
+        if(pids[i] == 0){
+            close(cmd_pipe[1]);
+            close(report_pipe[0]);
+            follower_child(follower_dir, sock, cmd_pipe[0], report_pipe[1]);
+        }
+        close(cmd_pipe[0]);
+        close(report_pipe[1]);
+        cmd[i] = cmd_pipe[1];
+        report[i] = report_pipe[0];
+    }
+
+    NewsDB *db = calloc(1, sizeof(NewsDB));
+    init_news_db(db);
+    ratelimit_set(&db->limits, 0, 0);
+    replica_primary_start(db, sock);
+
+    FollowerReport reps[3];
+    uint64_t hashes[3], lsns[3];
+    const int more[3] = {0, 100, REPLICA_BACKLOG * 2};
+    double t0 = now_sec();
+    int failed = run_follower(pids, cmd, report, 0, 0, 1, db, stories, &reps[0]) < 0;
+    double publish_sec = now_sec() - t0;
+    hashes[0] = ring_hash(db);
+    lsns[0] = primary_lsn(db);
+    for(int i = 1; i < runs && !failed; i++){
+        publish_stories(db, stories + more[i - 1] + 1, more[i], 0);
+        hashes[i] = ring_hash(db);
+        lsns[i] = primary_lsn(db);
+        failed = run_follower(pids, cmd, report, i, lsns[i], 0, db, stories, &reps[i]) < 0;
+    }
+    close_news_db(db);
+
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    close(devnull);
+
+    if(failed){
+        printf("Follower process failed\n");
+    }else{
+        printf("Primary published %d stories 200 us apart (%llu log records) in %.2f s, one follower streaming\n",
+               stories, (unsigned long long)lsns[0], publish_sec);
+        printf("  lag per record: p50 %.1f us, p99 %.1f us, max %.1f us; at most %llu records behind\n",
+               reps[0].p50_ns / 1e3, reps[0].p99_ns / 1e3, reps[0].max_ns / 1e3,
+               (unsigned long long)reps[0].max_behind);
+        const char *how[3] = {"live", "restart, backlog", "restart, snapshot"};
+        for(int i = 0; i < runs; i++)
+            printf("  %-18s %5llu records applied (%llu snapshots, %llu superseded), at record %llu in %.2f ms, "
+                   "buffer %s primary\n",
+                   how[i], (unsigned long long)reps[i].records, (unsigned long long)reps[i].snapshots,
+                   (unsigned long long)reps[i].superseded,
+                   (unsigned long long)reps[i].lsn, reps[i].catch_up_ms,
+                   reps[i].ring_hash == hashes[i] ? "matches" : "DIFFERS FROM");
+        for(int i = 0; i < runs; i++)
+            failed |= reps[i].ring_hash != hashes[i];
+    }
+
+    for(int i = 0; i < runs; i++){
+        close(cmd[i]);
+        close(report[i]);
+    }
+    while(wait(NULL) > 0)
+        ;
+    const char *files[] = {NEWS_FILE, NEWS_FILE ".tmp", CHECKPOINT_FILE, CHECKPOINT_FILE ".tmp", CATEGORY_FILE};
+    const char *dirs[] = {primary_dir, follower_dir};
+    for(int d = 0; d < 2; d++){
+        for(size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++){
+            char path[700];
+            snprintf(path, sizeof(path), "%s/%s", dirs[d], files[i]);
+            remove(path);
+        }
+        rmdir(dirs[d]);
+    }
+    if(chdir(cwd) < 0)
+        perror("Error leaving scratch directory");
+    rmdir(dir);
+    free(db);
+    return failed;
+}
+
+static void usage(const char *prog){
+    printf("Usage: %s loader [STORIES]\n", prog);
+    printf("       %s scan [STORIES]\n", prog);
+    printf("       %s trend [READS]\n", prog);
+    printf("       %s checkpoint [STORIES]\n", prog);
+    printf("       %s priority [SECONDS]\n", prog);
+    printf("       %s batch [STORIES]\n", prog);
+    printf("       %s listing [READS]\n", prog);
+    printf("       %s latency [STORIES]\n", prog);
+    printf("       %s replication [STORIES]\n", prog);
+}
+
+int main(int argc, char *argv[]){
+    if(argc < 2){
+        usage(argv[0]);
+        return 1;
+    }
+
+    int status;
+    if(strcmp(argv[1], "loader") == 0){
+        status = bench_loader(argc > 2 ? atoi(argv[2]) : 1000000);
+    }else if(strcmp(argv[1], "scan") == 0){
+        status = bench_scan(argc > 2 ? atoi(argv[2]) : 1000000);
+    }else if(strcmp(argv[1], "trend") == 0){
+        status = bench_trend(argc > 2 ? atol(argv[2]) : 10000000);
+    }else if(strcmp(argv[1], "checkpoint") == 0){
+        status = bench_checkpoint(argc > 2 ? atoi(argv[2]) : 1000000);
+    }else if(strcmp(argv[1], "priority") == 0){
+        status = bench_priority(argc > 2 ? atof(argv[2]) : 2.0);
+    }else if(strcmp(argv[1], "batch") == 0){
+        status = bench_batch(argc > 2 ? atoi(argv[2]) : 100000);
+    }else if(strcmp(argv[1], "listing") == 0){
+        status = bench_listing(argc > 2 ? atol(argv[2]) : 100000);
+    }else if(strcmp(argv[1], "latency") == 0){
+        status = bench_latency(argc > 2 ? atoi(argv[2]) : 5000);
+    }else if(strcmp(argv[1], "replication") == 0){
+        status = bench_replication(argc > 2 ? atoi(argv[2]) : 2000);
+    }else{
+        usage(argv[0]);
+        return 1;
+    }
+    executor_shutdown(executor_default());
+    return status;
+}
@@ -0,0 +1,269 @@
+#include "program.h"
+#include <fcntl.h>
+#include <sched.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+// Checkpoint file: a single CheckpointImage, written to a temp file and
+// renamed into place, so a crash leaves either the old image or the new one
+#define CHECKPOINT_MAGIC "NCKP"
+#define CHECKPOINT_VERSION 3
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t image_size;   // rejects images written by a different build
+    uint64_t log_offset;   // bytes of the news file the image covers
+    uint64_t tail_len;     // length and hash of the log record just before
+    uint64_t tail_hash;    // log_offset, to spot a file rewritten since
+    uint64_t replica_epoch;  // followers: the primary log record the ring
+    uint64_t replica_lsn;    // reflects
+    int next_id;
+    int num_news;
+    int start;
+    int end;
+    NewsStore store;
+    int dedup_window;
+    uint64_t dedup_entries[DEDUP_TABLE_SIZE];
+    uint64_t dedup_seen[DEDUP_TABLE_SIZE];
+    uint64_t checksum;
+} CheckpointImage;
+
+static uint64_t fnv64(const void *data, size_t len){
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for(size_t i = 0; i < len; i++)
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+    return h;
+}
+
+static double ms_since(const struct timespec *start){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Remember the last record of what the log now ends with (buf holds the
+// final len bytes of the log). Called with the store lock held.
+void checkpoint_note_tail(NewsDB *news_db, const char *buf, size_t len){
+    size_t start = len > 0 ? len - 1 : 0;
+    while(start > 0 && buf[start - 1] != '\n')
+        start--;
+    news_db->log_tail_len = len - start;
+    news_db->log_tail_hash = fnv64(buf + start, len - start);
+}
+
+void checkpoint_init(CheckpointState *cp, const char *path){
+    memset(cp, 0, sizeof(*cp));
+    pthread_mutex_init(&cp->mutex, NULL);
+    pthread_cond_init(&cp->done_cond, NULL);
+    snprintf(cp->path, sizeof(cp->path), "%s", path);
+}
+
+// Copy the ring, ID sequence and log position without taking the store
+// locks: retry until the copy doesn't overlap a write (seqlock). The dedup
+// table is lock-free anyway and is copied entry by entry.
+static void take_snapshot(NewsDB *news_db, CheckpointImage *img, uint64_t *ticket){
+    while(1){
+        unsigned seq = __atomic_load_n(&news_db->seq, __ATOMIC_ACQUIRE);
+        if(!(seq & 1)){
+            img->num_news = news_db->num_news;
+            img->start = news_db->start;
+            img->end = news_db->end;
+            img->next_id = __atomic_load_n(&news_db->next_id, __ATOMIC_RELAXED);
+            img->log_offset = news_db->log_bytes;
+            img->tail_len = news_db->log_tail_len;
+            img->tail_hash = news_db->log_tail_hash;
+            img->replica_epoch = news_db->replica_epoch;
+            img->replica_lsn = news_db->replica_lsn;
+            *ticket = news_db->last_ticket;
+            memcpy(&img->store, news_db->store, sizeof(img->store));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if(__atomic_load_n(&news_db->seq, __ATOMIC_RELAXED) == seq)
+                break;
+        }
+        sched_yield();
+    }
+
+    img->dedup_window = __atomic_load_n(&news_db->dedup.window_secs, __ATOMIC_RELAXED);
+    for(int i = 0; i < DEDUP_TABLE_SIZE; i++){
+        img->dedup_entries[i] = __atomic_load_n(&news_db->dedup.entries[i], __ATOMIC_ACQUIRE);
+        img->dedup_seen[i] = __atomic_load_n(&news_db->dedup.seen[i], __ATOMIC_ACQUIRE);
+    }
+}
+
+static int write_image(const char *path, const CheckpointImage *img){
+    char temp_path[300];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0)
+        return -1;
+
+    const char *p = (const char *)img;
+    size_t left = sizeof(*img);
+    while(left > 0){
+        ssize_t n = write(fd, p, left);
+        if(n <= 0){
+            close(fd);
+            return -1;
+        }
+        p += n;
+        left -= n;
+    }
+    if(fsync(fd) < 0){
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return rename(temp_path, path);
+}
+
+// Snapshot the database and write it out. Publishers keep going meanwhile;
+// the image is only written once the log it points into is durable.
+int checkpoint_write(NewsDB *news_db){
+    CheckpointState *cp = &news_db->checkpoint;
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    CheckpointImage *img = calloc(1, sizeof(CheckpointImage));
+    if(!img)
+        return -1;
+    uint64_t ticket;
+    take_snapshot(news_db, img, &ticket);
+    memcpy(img->magic, CHECKPOINT_MAGIC, 4);
+    img->version = CHECKPOINT_VERSION;
+    img->image_size = sizeof(CheckpointImage);
+
+    int status = persist_wait(&news_db->persist, ticket);
+    if(status == 0){
+        img->checksum = fnv64(img, offsetof(CheckpointImage, checksum));
+        status = write_image(cp->path, img);
+    }
+    if(status < 0)
+        perror("Error writing checkpoint");
+
+    pthread_mutex_lock(&cp->mutex);
+    if(status == 0){
+        cp->written++;
+        cp->last_offset = img->log_offset;
+        cp->last_ms = ms_since(&started);
+    }
+    pthread_mutex_unlock(&cp->mutex);
+    free(img);
+    return status;
+}
+
+static void checkpoint_task(void *arg){
+    NewsDB *news_db = (NewsDB *)arg;
+    CheckpointState *cp = &news_db->checkpoint;
+    checkpoint_write(news_db);
+
+    pthread_mutex_lock(&cp->mutex);
+    cp->running = 0;
+    pthread_cond_broadcast(&cp->done_cond);
+    pthread_mutex_unlock(&cp->mutex);
+}
+
+// Write a checkpoint on the executor unless one is already on its way
+void checkpoint_start(NewsDB *news_db){
+    CheckpointState *cp = &news_db->checkpoint;
+    pthread_mutex_lock(&cp->mutex);
+    if(cp->running){
+        pthread_mutex_unlock(&cp->mutex);
+        return;
+    }
+    cp->running = 1;
+    __atomic_store_n(&cp->since, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&cp->mutex);
+    executor_submit(news_db->persist.executor, checkpoint_task, news_db, NULL);
+}
+
+// Wait for a background checkpoint, then write a final one so the next
+// start has no log tail to replay
+void checkpoint_close(NewsDB *news_db){
+    CheckpointState *cp = &news_db->checkpoint;
+    pthread_mutex_lock(&cp->mutex);
+    while(cp->running)
+        executor_cond_wait(&cp->done_cond, &cp->mutex);
+    pthread_mutex_unlock(&cp->mutex);
+
+    checkpoint_write(news_db);
+    pthread_mutex_destroy(&cp->mutex);
+    pthread_cond_destroy(&cp->done_cond);
+}
+
+// Does the news file still hold the log the image was taken from?
+static int log_matches(NewsDB *news_db, const CheckpointImage *img){
+    int fd = fileno(news_file(news_db));
+    struct stat st;
+    if(fstat(fd, &st) < 0 || (uint64_t)st.st_size < img->log_offset)
+        return 0;
+    if(img->tail_len == 0)
+        return img->log_offset == 0;
+    if(img->tail_len > img->log_offset || img->tail_len > (1 << 20))
+        return 0;
+
+    char *tail = malloc(img->tail_len);
+    ssize_t n = tail ? pread(fd, tail, img->tail_len, (off_t)(img->log_offset - img->tail_len)) : -1;
+    int same = n == (ssize_t)img->tail_len && fnv64(tail, img->tail_len) == img->tail_hash;
+    free(tail);
+    return same;
+}
+
+// Restore the ring from the checkpoint and replay only the log after it.
+// Returns -1, leaving the database untouched, if there is no usable image.
+int checkpoint_restore(NewsDB *news_db){
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    CheckpointState *cp = &news_db->checkpoint;
+
+    FILE *file = fopen(cp->path, "rb");
+    if(!file)
+        return -1;
+    CheckpointImage *img = malloc(sizeof(CheckpointImage));
+    size_t got = img ? fread(img, 1, sizeof(CheckpointImage), file) : 0;
+    fclose(file);
+
+    const char *problem = NULL;
+    if(got != sizeof(CheckpointImage) || memcmp(img->magic, CHECKPOINT_MAGIC, 4) != 0
+       || img->version != CHECKPOINT_VERSION || img->image_size != sizeof(CheckpointImage))
+        problem = "not a checkpoint from this build";
+    else if(img->checksum != fnv64(img, offsetof(CheckpointImage, checksum)))
+        problem = "checksum mismatch";
+    else if(img->num_news < 0 || img->num_news > MAX_NEWS || img->start < 0 || img->start >= MAX_NEWS
+            || img->end < 0 || img->end >= MAX_NEWS)
+        problem = "bad ring";
+    else if(!log_matches(news_db, img))
+        problem = "news file changed since";
+    if(problem){
+        printf("[CHECKPOINT] Ignoring %s (%s), loading the whole news file\n", cp->path, problem);
+        free(img);
+        return -1;
+    }
+
+    memcpy(news_db->store, &img->store, sizeof(*news_db->store));
+    // Publish times belong to the run that took them
+    memset(news_db->store->published_ns, 0, sizeof(news_db->store->published_ns));
+    news_db->num_news = img->num_news;
+    news_db->start = img->start;
+    news_db->end = img->end;
+    news_db->next_id = img->next_id;
+    news_db->log_tail_len = img->tail_len;
+    news_db->log_tail_hash = img->tail_hash;
+    news_db->replica_epoch = img->replica_epoch;
+    news_db->replica_lsn = img->replica_lsn;
+
+    // Claims still in flight when the image was taken will never finish
+    news_db->dedup.window_secs = img->dedup_window;
+    memcpy(news_db->dedup.entries, img->dedup_entries, sizeof(news_db->dedup.entries));
+    memcpy(news_db->dedup.seen, img->dedup_seen, sizeof(news_db->dedup.seen));
+    dedup_drop_pending(&news_db->dedup);
+    news_db->dedup.lookups = news_db->dedup.hits = 0;
+
+    load_news_tail(news_db, img->log_offset);
+    printf("[CHECKPOINT] Restored %d stories from byte %llu of the log, replayed %llu bytes after it in %.2f ms\n",
+           img->num_news, (unsigned long long)img->log_offset,
+           (unsigned long long)(news_db->log_bytes - img->log_offset), ms_since(&started));
+    free(img);
+    return 0;
+}
@@ -0,0 +1,240 @@
+#include "program.h"
+#include <ctype.h>
+
+// An entry packs (fingerprint << 32 | id). id 0 means the first publisher of
+// the story is still inside add_news and has not been given an ID yet. A
+// tombstone (fingerprint 0, which no story has) marks a claim given back in
+// the middle of a probe chain: probing goes past it and claims reuse it.
+#define DEDUP_PENDING 0u
+#define DEDUP_TOMBSTONE 1ULL
+#define DEDUP_MASK (DEDUP_TABLE_SIZE - 1)
+
+static inline uint32_t entry_fp(uint64_t entry) { return (uint32_t)(entry >> 32); }
+static inline uint32_t entry_id(uint64_t entry) { return (uint32_t)entry; }
+
+// splitmix64 finalizer so the low bits are usable as a table index
+static inline uint64_t mix64(uint64_t h){
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+// Feed one field into the hash, lower-cased with whitespace runs collapsed
+static uint64_t hash_field(uint64_t h, const char *s){
+    int pending_space = 0;
+    while(*s && isspace((unsigned char)*s))
+        s++;
+    for(; *s; s++){
+        unsigned char c = (unsigned char)*s;
+        if(isspace(c)){
+            pending_space = 1;
+            continue;
+        }
+        if(pending_space){
+            h = (h ^ ' ') * 0x100000001b3ULL;
+            pending_space = 0;
+        }
+        h = (h ^ (unsigned char)tolower(c)) * 0x100000001b3ULL;
+    }
+    // Field separator so "A|BC" and "AB|C" differ
+    return (h ^ 0x1f) * 0x100000001b3ULL;
+}
+
+uint64_t dedup_hash(const char *category, const char *title, const char *content){
+    uint64_t h = 0xcbf29ce484222325ULL;
+    h = hash_field(h, category);
+    h = hash_field(h, title);
+    h = hash_field(h, content);
+    h = mix64(h);
+    // Keep the fingerprint non-zero so an empty slot is always 0
+    return (h >> 32) ? h : h | (1ULL << 32);
+}
+
+void dedup_init(DedupTable *table, int window_secs, int process_shared){
+    pthread_mutexattr_t mattr;
+    pthread_condattr_t cattr;
+    pthread_mutexattr_init(&mattr);
+    pthread_condattr_init(&cattr);
+    if(process_shared){
+        pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+        pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    }
+
+    memset(table, 0, sizeof(*table));
+    table->window_secs = window_secs;
+    pthread_mutex_init(&table->wait_lock, &mattr);
+    pthread_cond_init(&table->resolved, &cattr);
+    pthread_mutexattr_destroy(&mattr);
+    pthread_condattr_destroy(&cattr);
+}
+
+void dedup_destroy(DedupTable *table){
+    pthread_mutex_destroy(&table->wait_lock);
+    pthread_cond_destroy(&table->resolved);
+}
+
+void dedup_set_window(DedupTable *table, int window_secs){
+    __atomic_store_n(&table->window_secs, window_secs, __ATOMIC_RELAXED);
+}
+
+// Has the story with this ID aged out of the window?
+static int id_expired(DedupTable *table, uint32_t id, uint32_t now){
+    uint64_t seen = __atomic_load_n(&table->seen[id & DEDUP_MASK], __ATOMIC_ACQUIRE);
+    if((uint32_t)(seen >> 32) != id)
+        return 1; // slot reused by a much newer ID
+    uint32_t window = (uint32_t)__atomic_load_n(&table->window_secs, __ATOMIC_RELAXED);
+    return now - (uint32_t)seen > window;
+}
+
+// Look the story up; returns the existing ID for a duplicate, or 0 with *slot
+// set to a claimed entry the caller must finish with dedup_publish/dedup_abandon
+// (*slot is -1 when dedup is off or the probe window is full). Returns -1
+// with *slot set to another publisher's pending claim on the same story:
+// dedup_wait on it, then look again.
+int dedup_claim(DedupTable *table, uint64_t hash, uint32_t now, int *slot){
+    *slot = -1;
+    if(__atomic_load_n(&table->window_secs, __ATOMIC_RELAXED) <= 0)
+        return 0;
+
+    __atomic_fetch_add(&table->lookups, 1, __ATOMIC_RELAXED);
+    uint32_t fp = (uint32_t)(hash >> 32);
+    uint64_t mine = (uint64_t)fp << 32 | DEDUP_PENDING;
+
+    while(1){
+        int reusable = -1;
+        uint64_t reusable_old = 0;
+
+        for(int probe = 0; probe < DEDUP_MAX_PROBE; probe++){
+            int index = (int)((hash + probe) & DEDUP_MASK);
+            uint64_t entry = __atomic_load_n(&table->entries[index], __ATOMIC_ACQUIRE);
+
+            if(entry == 0){
+                if(reusable < 0){
+                    reusable = index;
+                    reusable_old = 0;
+                }
+                break; // end of the probe chain
+            }
+            if(entry == DEDUP_TOMBSTONE){
+                if(reusable < 0){
+                    reusable = index;
+                    reusable_old = entry;
+                }
+                continue;
+            }
+            if(entry_id(entry) == DEDUP_PENDING){
+                if(entry_fp(entry) == fp){
+                    *slot = index; // same story is being published right now
+                    return -1;
+                }
+                continue;
+            }
+            if(!id_expired(table, entry_id(entry), now)){
+                if(entry_fp(entry) == fp){
+                    __atomic_fetch_add(&table->hits, 1, __ATOMIC_RELAXED);
+                    return (int)entry_id(entry);
+                }
+            }else if(reusable < 0){
+                reusable = index;
+                reusable_old = entry;
+            }
+        }
+
+        if(reusable < 0)
+            return 0;
+        if(__atomic_compare_exchange_n(&table->entries[reusable], &reusable_old, mine, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+            *slot = reusable;
+            return 0;
+        }
+        // lost the race for that slot, look again
+    }
+}
+
+// Finish a pending entry, waking anyone in dedup_wait. The store and the
+// waiter count are both sequentially consistent, so either the waiter sees
+// the new entry or we see the waiter.
+static void resolve(DedupTable *table, int slot, uint64_t entry){
+    __atomic_store_n(&table->entries[slot], entry, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&table->waiters, __ATOMIC_SEQ_CST) > 0){
+        pthread_mutex_lock(&table->wait_lock);
+        pthread_cond_broadcast(&table->resolved);
+        pthread_mutex_unlock(&table->wait_lock);
+    }
+}
+
+// Wait until the pending claim dedup_claim reported in slot is published or
+// given back. Callers must not hold claims of their own, which whoever they
+// wait on (possibly a task run on this worker meanwhile) could be stuck on.
+void dedup_wait(DedupTable *table, int slot, uint64_t hash){
+    uint64_t pending = (hash >> 32) << 32 | DEDUP_PENDING;
+    pthread_mutex_lock(&table->wait_lock);
+    __atomic_add_fetch(&table->waiters, 1, __ATOMIC_SEQ_CST);
+    while(__atomic_load_n(&table->entries[slot], __ATOMIC_SEQ_CST) == pending)
+        executor_cond_wait(&table->resolved, &table->wait_lock);
+    __atomic_sub_fetch(&table->waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&table->wait_lock);
+}
+
+// Attach the assigned ID to a claimed entry
+void dedup_publish(DedupTable *table, int slot, uint64_t hash, int id, uint32_t now){
+    if(slot < 0)
+        return;
+    __atomic_store_n(&table->seen[(uint32_t)id & DEDUP_MASK], (uint64_t)(uint32_t)id << 32 | now, __ATOMIC_RELEASE);
+    resolve(table, slot, (hash >> 32) << 32 | (uint32_t)id);
+}
+
+// Give a claimed entry back when the story was not stored after all. Later
+// entries of the chain may sit behind it, so it only becomes empty when the
+// next slot is.
+void dedup_abandon(DedupTable *table, int slot){
+    if(slot < 0)
+        return;
+    uint64_t next = __atomic_load_n(&table->entries[(slot + 1) & DEDUP_MASK], __ATOMIC_ACQUIRE);
+    resolve(table, slot, next == 0 ? 0 : DEDUP_TOMBSTONE);
+}
+
+// The published entry in index, if any, with its seen stamp: for copying a
+// table's state elsewhere (trace recording)
+int dedup_get_entry(DedupTable *table, int index, uint64_t *entry, uint64_t *seen){
+    uint64_t value = __atomic_load_n(&table->entries[index], __ATOMIC_ACQUIRE);
+    if(value == 0 || value == DEDUP_TOMBSTONE || entry_id(value) == DEDUP_PENDING)
+        return 0;
+    *entry = value;
+    *seen = __atomic_load_n(&table->seen[entry_id(value) & DEDUP_MASK], __ATOMIC_ACQUIRE);
+    return 1;
+}
+
+// Put back an entry dedup_get_entry gave out (table not yet in use)
+void dedup_set_entry(DedupTable *table, int index, uint64_t entry, uint64_t seen){
+    table->entries[index & DEDUP_MASK] = entry;
+    table->seen[entry_id(entry) & DEDUP_MASK] = seen;
+}
+
+// Claims still pending in a restored table will never finish: give them all
+// back. From the top down, so a run of them at the end of a chain empties.
+void dedup_drop_pending(DedupTable *table){
+    for(int i = DEDUP_TABLE_SIZE - 1; i >= 0; i--){
+        uint64_t entry = table->entries[i];
+        if(entry != 0 && entry != DEDUP_TOMBSTONE && entry_id(entry) == DEDUP_PENDING)
+            table->entries[i] = table->entries[(i + 1) & DEDUP_MASK] == 0 ? 0 : DEDUP_TOMBSTONE;
+    }
+}
+
+// Register a story that is already stored (e.g. loaded from the file)
+void dedup_seed(DedupTable *table, const News *news_item){
+    uint64_t hash = dedup_hash(news_item->category, news_item->title, news_item->content);
+    uint32_t seen = (uint32_t)news_item->timestamp;
+    int slot;
+    // A story someone is publishing right now gets its entry from them
+    if(dedup_claim(table, hash, seen, &slot) == 0)
+        dedup_publish(table, slot, hash, news_item->id, seen);
+}
+
+double dedup_hit_rate(const DedupTable *table){
+    uint64_t lookups = __atomic_load_n(&table->lookups, __ATOMIC_RELAXED);
+    uint64_t hits = __atomic_load_n(&table->hits, __ATOMIC_RELAXED);
+    return lookups ? (double)hits / lookups : 0.0;
+}
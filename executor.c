@@ -0,0 +1,390 @@
+#include "program.h"
+#include <errno.h>
+
+// A worker that has nothing to help with re-checks its condition this often
+#define HELP_WAIT_MS 10
+// Tasks run while waiting can wait and help in turn, each a frame deeper on
+// the worker's stack; past this many a waiter just waits
+#define MAX_HELP_DEPTH 8
+
+static __thread Executor *current_executor = NULL;
+static __thread int current_worker = -1;
+static __thread int help_depth = 0;
+
+static Executor *default_executor = NULL;
+static pthread_once_t default_once = PTHREAD_ONCE_INIT;
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Absolute CLOCK_REALTIME deadline timeout_ms from now, for timed waits
+static struct timespec deadline_after(int timeout_ms){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if(ts.tv_nsec >= 1000000000L){
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+// Owner pushes and pops at the bottom; thieves take from the top.
+// Returns -1 if the deque couldn't grow to take the task.
+static int deque_push(WorkDeque *dq, Task task){
+    pthread_mutex_lock(&dq->lock);
+    if(dq->count == dq->cap){
+        int cap = dq->cap ? dq->cap * 2 : 16;
+        Task *items = malloc(cap * sizeof(Task));
+        if(!items){
+            pthread_mutex_unlock(&dq->lock);
+            return -1;
+        }
+        for(int i = 0; i < dq->count; i++)
+            items[i] = dq->items[(dq->head + i) % dq->cap];
+        free(dq->items);
+        dq->items = items;
+        dq->head = 0;
+        dq->cap = cap;
+    }
+    dq->items[(dq->head + dq->count) % dq->cap] = task;
+    dq->count++;
+    pthread_mutex_unlock(&dq->lock);
+    return 0;
+}
+
+static int deque_pop(WorkDeque *dq, Task *task){
+    int found = 0;
+    pthread_mutex_lock(&dq->lock);
+    if(dq->count > 0){
+        dq->count--;
+        *task = dq->items[(dq->head + dq->count) % dq->cap];
+        found = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+static int deque_steal(WorkDeque *dq, Task *task){
+    int found = 0;
+    pthread_mutex_lock(&dq->lock);
+    if(dq->count > 0){
+        *task = dq->items[dq->head];
+        dq->head = (dq->head + 1) % dq->cap;
+        dq->count--;
+        found = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+static void group_add(TaskGroup *group){
+    if(!group)
+        return;
+    pthread_mutex_lock(&group->lock);
+    group->pending++;
+    pthread_mutex_unlock(&group->lock);
+}
+
+static void group_done(TaskGroup *group){
+    if(!group)
+        return;
+    pthread_mutex_lock(&group->lock);
+    if(--group->pending == 0)
+        pthread_cond_broadcast(&group->done);
+    pthread_mutex_unlock(&group->lock);
+}
+
+static void run_task(Task *task){
+    task->fn(task->arg);
+    group_done(task->group);
+}
+
+static int next_queue(Executor *ex){
+    return (int)(__atomic_fetch_add(&ex->next_queue, 1, __ATOMIC_RELAXED) % ex->num_workers);
+}
+
+// Queue a ready task: the caller's own deque if it is a worker, else
+// round-robin. With no memory to queue it, the caller runs it right away
+// rather than lose it.
+static void enqueue(Executor *ex, Task task){
+    int target = current_executor == ex ? current_worker : next_queue(ex);
+    if(deque_push(&ex->deques[target], task) < 0){
+        perror("Error queueing task");
+        run_task(&task);
+        return;
+    }
+    __atomic_fetch_add(&ex->ready, 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&ex->lock);
+    pthread_cond_signal(&ex->wake);
+    pthread_mutex_unlock(&ex->lock);
+}
+
+// Own deque first, then try every other worker's
+static int find_task(Executor *ex, int worker, Task *task){
+    if(worker >= 0 && deque_pop(&ex->deques[worker], task))
+        goto found;
+    for(int i = 1; i <= ex->num_workers; i++){
+        int victim = (worker + i) % ex->num_workers;
+        if(deque_steal(&ex->deques[victim], task))
+            goto found;
+    }
+    return 0;
+
+found:
+    __atomic_fetch_sub(&ex->ready, 1, __ATOMIC_ACQ_REL);
+    return 1;
+}
+
+// Move delayed tasks whose time has come onto the ready queues, spread
+// round-robin like outside submissions. One that can't be queued stays a
+// timer and is tried again next time. (ex->lock held)
+static int release_timers(Executor *ex){
+    uint64_t now = now_ns();
+    int moved = 0;
+    for(int i = 0; i < ex->num_timers; i++){
+        if(ex->timers[i].due_ns > now || deque_push(&ex->deques[next_queue(ex)], ex->timers[i]) < 0)
+            continue;
+        ex->timers[i--] = ex->timers[--ex->num_timers];
+        __atomic_fetch_add(&ex->ready, 1, __ATOMIC_RELEASE);
+        moved++;
+    }
+    if(moved > 1)
+        pthread_cond_broadcast(&ex->wake);
+    return moved;
+}
+
+static uint64_t earliest_timer(Executor *ex){
+    uint64_t earliest = UINT64_MAX;
+    for(int i = 0; i < ex->num_timers; i++)
+        if(ex->timers[i].due_ns < earliest)
+            earliest = ex->timers[i].due_ns;
+    return earliest;
+}
+
+static void *worker_main(void *arg){
+    Executor *ex = (Executor *)arg;
+    pthread_mutex_lock(&ex->lock);
+    int worker = ex->started++;
+    pthread_mutex_unlock(&ex->lock);
+    current_executor = ex;
+    current_worker = worker;
+
+    while(1){
+        Task task;
+        if(find_task(ex, worker, &task)){
+            run_task(&task);
+            continue;
+        }
+
+        pthread_mutex_lock(&ex->lock);
+        if(release_timers(ex) > 0 || __atomic_load_n(&ex->ready, __ATOMIC_ACQUIRE) > 0){
+            pthread_mutex_unlock(&ex->lock);
+            continue;
+        }
+        if(ex->stop){
+            pthread_mutex_unlock(&ex->lock);
+            break;
+        }
+
+        uint64_t earliest = earliest_timer(ex);
+        if(earliest == UINT64_MAX){
+            pthread_cond_wait(&ex->wake, &ex->lock);
+        }else{
+            uint64_t now = now_ns();
+            int wait_ms = earliest > now ? (int)((earliest - now) / 1000000ULL) + 1 : 0;
+            struct timespec deadline = deadline_after(wait_ms);
+            pthread_cond_timedwait(&ex->wake, &ex->lock, &deadline);
+        }
+        pthread_mutex_unlock(&ex->lock);
+    }
+    return NULL;
+}
+
+// Start a pool of num_workers threads (0 = one per online CPU)
+Executor *executor_create(int num_workers){
+    if(num_workers <= 0){
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_workers = cpus > 0 ? (int)cpus : 1;
+    }
+
+    Executor *ex = calloc(1, sizeof(Executor));
+    ex->num_workers = num_workers;
+    ex->deques = calloc(num_workers, sizeof(WorkDeque));
+    ex->threads = calloc(num_workers, sizeof(pthread_t));
+    pthread_mutex_init(&ex->lock, NULL);
+    pthread_cond_init(&ex->wake, NULL);
+    for(int i = 0; i < num_workers; i++)
+        pthread_mutex_init(&ex->deques[i].lock, NULL);
+    for(int i = 0; i < num_workers; i++)
+        pthread_create(&ex->threads[i], NULL, worker_main, ex);
+    return ex;
+}
+
+// Cooperative shutdown: workers finish every ready task, delayed tasks are
+// dropped, then the threads are joined. Nothing is ever cancelled.
+void executor_shutdown(Executor *ex){
+    pthread_mutex_lock(&ex->lock);
+    ex->stop = 1;
+    int dropped = ex->num_timers;
+    Task *timers = ex->timers;
+    ex->timers = NULL;
+    ex->num_timers = ex->cap_timers = 0;
+    pthread_cond_broadcast(&ex->wake);
+    pthread_mutex_unlock(&ex->lock);
+
+    for(int i = 0; i < dropped; i++)
+        group_done(timers[i].group);
+    free(timers);
+
+    for(int i = 0; i < ex->num_workers; i++)
+        pthread_join(ex->threads[i], NULL);
+    for(int i = 0; i < ex->num_workers; i++){
+        pthread_mutex_destroy(&ex->deques[i].lock);
+        free(ex->deques[i].items);
+    }
+    pthread_mutex_destroy(&ex->lock);
+    pthread_cond_destroy(&ex->wake);
+    free(ex->deques);
+    free(ex->threads);
+    free(ex);
+}
+
+static void create_default(void){
+    default_executor = executor_create(0);
+}
+
+// Process-wide pool, started on first use
+Executor *executor_default(void){
+    pthread_once(&default_once, create_default);
+    return default_executor;
+}
+
+void executor_submit(Executor *ex, TaskFn fn, void *arg, TaskGroup *group){
+    Task task = {fn, arg, group, 0};
+    group_add(group);
+    enqueue(ex, task);
+}
+
+// Run fn after delay_ms without tying up a worker in the meantime
+void executor_submit_after(Executor *ex, TaskFn fn, void *arg, TaskGroup *group, int delay_ms){
+    if(delay_ms <= 0){
+        executor_submit(ex, fn, arg, group);
+        return;
+    }
+    Task task = {fn, arg, group, now_ns() + (uint64_t)delay_ms * 1000000ULL};
+    group_add(group);
+
+    pthread_mutex_lock(&ex->lock);
+    if(ex->stop){
+        pthread_mutex_unlock(&ex->lock);
+        group_done(group);
+        return;
+    }
+    if(ex->num_timers == ex->cap_timers){
+        int cap = ex->cap_timers ? ex->cap_timers * 2 : 16;
+        Task *timers = realloc(ex->timers, cap * sizeof(Task));
+        if(!timers){
+            // Early beats never
+            pthread_mutex_unlock(&ex->lock);
+            perror("Error scheduling task");
+            enqueue(ex, task);
+            return;
+        }
+        ex->timers = timers;
+        ex->cap_timers = cap;
+    }
+    ex->timers[ex->num_timers++] = task;
+    pthread_cond_signal(&ex->wake);
+    pthread_mutex_unlock(&ex->lock);
+}
+
+int executor_stopping(Executor *ex){
+    pthread_mutex_lock(&ex->lock);
+    int stop = ex->stop;
+    pthread_mutex_unlock(&ex->lock);
+    return stop;
+}
+
+// Run one ready task on behalf of a worker that is waiting for something.
+// Returns 0 when called off the pool, when there was nothing to run, or
+// when the worker is already MAX_HELP_DEPTH tasks deep in waits.
+int executor_help(Executor *ex){
+    if(current_executor != ex || help_depth >= MAX_HELP_DEPTH)
+        return 0;
+    Task task;
+    if(!find_task(ex, current_worker, &task))
+        return 0;
+    help_depth++;
+    run_task(&task);
+    help_depth--;
+    return 1;
+}
+
+// pthread_cond_wait for code that may run on a pool worker: a worker keeps
+// running other tasks instead of sleeping, so whatever it waits for (often
+// another task) still gets a thread. Like cond_wait, may return spuriously.
+void executor_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex){
+    Executor *ex = current_executor;
+    if(!ex){
+        pthread_cond_wait(cond, mutex);
+        return;
+    }
+    pthread_mutex_unlock(mutex);
+    int helped = executor_help(ex);
+    pthread_mutex_lock(mutex);
+    if(!helped){
+        struct timespec deadline = deadline_after(HELP_WAIT_MS);
+        pthread_cond_timedwait(cond, mutex, &deadline);
+    }
+}
+
+// Sleep for code that may run on a pool worker: until the deadline a
+// worker runs other ready tasks, and only naps in short slices when there
+// is nothing to help with
+void executor_sleep(uint64_t ns){
+    uint64_t deadline = now_ns() + ns;
+    Executor *ex = current_executor;
+    for(uint64_t now = now_ns(); now < deadline; now = now_ns()){
+        if(ex && executor_help(ex))
+            continue;
+        uint64_t slice = deadline - now;
+        if(ex && slice > HELP_WAIT_MS * 1000000ULL)
+            slice = HELP_WAIT_MS * 1000000ULL;
+        struct timespec ts = {(time_t)(slice / 1000000000ULL), (long)(slice % 1000000000ULL)};
+        nanosleep(&ts, NULL);
+    }
+}
+
+void task_group_init(TaskGroup *group){
+    pthread_mutex_init(&group->lock, NULL);
+    pthread_cond_init(&group->done, NULL);
+    group->pending = 0;
+}
+
+void task_group_destroy(TaskGroup *group){
+    pthread_mutex_destroy(&group->lock);
+    pthread_cond_destroy(&group->done);
+}
+
+// Wait until every task in the group (and any it resubmitted) has finished.
+// timeout_ms < 0 waits forever. Returns 1 when the group is empty.
+int task_group_wait(TaskGroup *group, int timeout_ms){
+    struct timespec deadline = deadline_after(timeout_ms > 0 ? timeout_ms : 0);
+    pthread_mutex_lock(&group->lock);
+    while(group->pending > 0){
+        if(timeout_ms < 0){
+            executor_cond_wait(&group->done, &group->lock);
+        }else if(pthread_cond_timedwait(&group->done, &group->lock, &deadline) == ETIMEDOUT){
+            break;
+        }
+    }
+    int empty = group->pending == 0;
+    pthread_mutex_unlock(&group->lock);
+    return empty;
+}
@@ -0,0 +1,152 @@
+#include "program.h"
+#include <errno.h>
+
+// Set up every subscription slot's lock and condition variables once
+void fanout_init(FanOut *fan, int process_shared){
+    pthread_mutexattr_t mattr;
+    pthread_condattr_t cattr;
+    pthread_mutexattr_init(&mattr);
+    pthread_condattr_init(&cattr);
+    if(process_shared){
+        pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+        pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    }
+
+    pthread_mutex_init(&fan->registry_lock, &mattr);
+    for(int i = 0; i < MAX_SUBSCRIBERS; i++){
+        Subscription *sub = &fan->subs[i];
+        memset(sub, 0, sizeof(*sub));
+        pthread_mutex_init(&sub->mutex, &mattr);
+        pthread_cond_init(&sub->not_empty, &cattr);
+        pthread_cond_init(&sub->not_full, &cattr);
+    }
+    pthread_mutexattr_destroy(&mattr);
+    pthread_condattr_destroy(&cattr);
+}
+
+void fanout_destroy(FanOut *fan){
+    for(int i = 0; i < MAX_SUBSCRIBERS; i++){
+        pthread_mutex_destroy(&fan->subs[i].mutex);
+        pthread_cond_destroy(&fan->subs[i].not_empty);
+        pthread_cond_destroy(&fan->subs[i].not_full);
+    }
+    pthread_mutex_destroy(&fan->registry_lock);
+}
+
+// Register a subscriber with its own bounded queue; returns its handle or -1
+int fanout_subscribe(FanOut *fan, OverflowPolicy policy){
+    int handle = -1;
+    pthread_mutex_lock(&fan->registry_lock);
+    for(int i = 0; i < MAX_SUBSCRIBERS; i++){
+        Subscription *sub = &fan->subs[i];
+        if(__atomic_load_n(&sub->active, __ATOMIC_ACQUIRE))
+            continue;
+
+        pthread_mutex_lock(&sub->mutex);
+        sub->policy = policy;
+        sub->head = 0;
+        sub->count = 0;
+        sub->connected = 1;
+        sub->delivered = 0;
+        sub->dropped = 0;
+        __atomic_store_n(&sub->active, 1, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&sub->mutex);
+        handle = i;
+        break;
+    }
+    pthread_mutex_unlock(&fan->registry_lock);
+    return handle;
+}
+
+// Remove a subscriber, waking any publisher blocked on its queue
+void fanout_unsubscribe(FanOut *fan, int handle){
+    if(handle < 0 || handle >= MAX_SUBSCRIBERS)
+        return;
+    Subscription *sub = &fan->subs[handle];
+    pthread_mutex_lock(&sub->mutex);
+    __atomic_store_n(&sub->active, 0, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&sub->not_full);
+    pthread_cond_broadcast(&sub->not_empty);
+    pthread_mutex_unlock(&sub->mutex);
+}
+
+// Hand a new story to every subscriber. Only a subscriber with the BLOCK
+// policy and a full queue can make the publisher wait, and only for itself.
+// On an executor worker the wait keeps running other tasks, so the reader
+// that would drain the queue is never starved of a worker.
+void fanout_publish(FanOut *fan, StoryRef ref){
+    for(int i = 0; i < MAX_SUBSCRIBERS; i++){
+        Subscription *sub = &fan->subs[i];
+        if(!__atomic_load_n(&sub->active, __ATOMIC_ACQUIRE))
+            continue;
+
+        pthread_mutex_lock(&sub->mutex);
+        while(sub->active && sub->connected && sub->count == SUB_QUEUE_CAP && sub->policy == OVERFLOW_BLOCK)
+            executor_cond_wait(&sub->not_full, &sub->mutex);
+
+        if(sub->active && sub->connected){
+            if(sub->count == SUB_QUEUE_CAP){
+                sub->dropped++;
+                if(sub->policy == OVERFLOW_DISCONNECT){
+                    sub->connected = 0;
+                    pthread_cond_broadcast(&sub->not_empty);
+                    pthread_mutex_unlock(&sub->mutex);
+                    continue;
+                }
+                // OVERFLOW_DROP_OLDEST
+                sub->head = (sub->head + 1) % SUB_QUEUE_CAP;
+                sub->count--;
+            }
+            sub->queue[(sub->head + sub->count) % SUB_QUEUE_CAP] = ref;
+            sub->count++;
+            sub->delivered++;
+            pthread_cond_signal(&sub->not_empty);
+        }
+        pthread_mutex_unlock(&sub->mutex);
+    }
+}
+
+// Take the next story reference for a subscriber, waiting up to timeout_ms
+// (0 = don't wait). Returns 1 with *ref set, 0 if nothing arrived, or -1 if
+// the subscriber was disconnected for falling behind.
+int fanout_next(FanOut *fan, int handle, StoryRef *ref, int timeout_ms){
+    Subscription *sub = &fan->subs[handle];
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if(deadline.tv_nsec >= 1000000000L){
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&sub->mutex);
+    int waited = 0;
+    while(sub->count == 0 && sub->connected && sub->active && timeout_ms > 0 && !waited)
+        waited = pthread_cond_timedwait(&sub->not_empty, &sub->mutex, &deadline) == ETIMEDOUT;
+
+    int result = 0;
+    if(sub->count > 0){
+        *ref = sub->queue[sub->head];
+        sub->head = (sub->head + 1) % SUB_QUEUE_CAP;
+        sub->count--;
+        pthread_cond_signal(&sub->not_full);
+        result = 1;
+    }else if(!sub->connected){
+        result = -1;
+    }
+    pthread_mutex_unlock(&sub->mutex);
+    return result;
+}
+
+const char *overflow_policy_name(OverflowPolicy policy){
+    switch(policy){
+    case OVERFLOW_BLOCK:
+        return "block";
+    case OVERFLOW_DROP_OLDEST:
+        return "drop-oldest";
+    default:
+        return "disconnect";
+    }
+}
@@ -0,0 +1,111 @@
+#include "program.h"
+
+#define SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+
+uint64_t latency_now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void latency_init(LatencyTable *table){
+    memset(table, 0, sizeof(*table));
+}
+
+// Values below SUB_BUCKETS get a bucket each; above that, the top
+// LATENCY_SUB_BITS bits after the leading one pick the bucket
+static int bucket_of(uint64_t ns){
+    if(ns < SUB_BUCKETS)
+        return (int)ns;
+    int shift = 63 - __builtin_clzll(ns) - LATENCY_SUB_BITS;
+    return ((shift + 1) << LATENCY_SUB_BITS) + (int)((ns >> shift) & (SUB_BUCKETS - 1));
+}
+
+// Highest value that lands in bucket
+static uint64_t bucket_top(int bucket){
+    if(bucket < SUB_BUCKETS)
+        return (uint64_t)bucket;
+    int shift = (bucket >> LATENCY_SUB_BITS) - 1;
+    uint64_t low = (uint64_t)(SUB_BUCKETS + (bucket & (SUB_BUCKETS - 1))) << shift;
+    return low + ((1ULL << shift) - 1);
+}
+
+void latency_record(LatencyHistogram *hist, uint64_t ns){
+    __atomic_fetch_add(&hist->counts[bucket_of(ns)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->total, 1, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&hist->max_ns, __ATOMIC_RELAXED);
+    while(ns > max && !__atomic_compare_exchange_n(&hist->max_ns, &max, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+// Count the first read of the story in slot, by a listing or a delivery,
+// against its category. Later reads would measure the story's age, not how
+// fast it got out. Caller holds lock.
+void latency_record_read(NewsDB *news_db, int slot, uint64_t now_ns){
+    NewsStore *store = news_db->store;
+    uint64_t published = store->published_ns[slot];
+    if(published == 0 || now_ns < published)
+        return;
+    if(__atomic_exchange_n(&store->counted[slot], 1, __ATOMIC_RELAXED))
+        return;
+    uint8_t cat = store->category[slot];
+    int key = cat < NUM_CATEGORIES ? cat : NUM_CATEGORIES;
+    latency_record(&news_db->latency.by_category[key], now_ns - published);
+}
+
+// Smallest recorded bucket value with at least fraction p of the samples
+// at or below it, capped at the largest sample seen
+uint64_t latency_percentile(const LatencyHistogram *hist, double p){
+    uint64_t total = __atomic_load_n(&hist->total, __ATOMIC_RELAXED);
+    if(total == 0)
+        return 0;
+    uint64_t want = (uint64_t)(p * total + 0.5);
+    if(want == 0)
+        want = 1;
+    uint64_t seen = 0;
+    uint64_t max = __atomic_load_n(&hist->max_ns, __ATOMIC_RELAXED);
+    for(int b = 0; b < LATENCY_BUCKETS; b++){
+        seen += __atomic_load_n(&hist->counts[b], __ATOMIC_RELAXED);
+        if(seen >= want){
+            uint64_t top = bucket_top(b);
+            return top < max ? top : max;
+        }
+    }
+    return max;
+}
+
+void latency_merge(LatencyHistogram *into, const LatencyHistogram *from){
+    for(int b = 0; b < LATENCY_BUCKETS; b++)
+        into->counts[b] += __atomic_load_n(&from->counts[b], __ATOMIC_RELAXED);
+    into->total += __atomic_load_n(&from->total, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&from->max_ns, __ATOMIC_RELAXED);
+    if(max > into->max_ns)
+        into->max_ns = max;
+}
+
+static void print_row(const char *name, const LatencyHistogram *hist){
+    printf("%-14s %8llu %10.3f %10.3f %10.3f %10.3f %10.3f\n", name, (unsigned long long)hist->total,
+           latency_percentile(hist, 0.50) / 1e6, latency_percentile(hist, 0.90) / 1e6,
+           latency_percentile(hist, 0.99) / 1e6, latency_percentile(hist, 0.999) / 1e6,
+           hist->max_ns / 1e6);
+}
+
+// Publish-to-read percentiles per category, in milliseconds
+void show_latency(NewsDB *news_db){
+    LatencyHistogram all;
+    memset(&all, 0, sizeof(all));
+
+    printf("\n=== Publish-to-read latency (ms) ===\n");
+    printf("%-14s %8s %10s %10s %10s %10s %10s\n", "Category", "Reads", "p50", "p90", "p99", "p99.9", "max");
+    for(int key = 0; key <= NUM_CATEGORIES; key++){
+        const LatencyHistogram *hist = &news_db->latency.by_category[key];
+        if(__atomic_load_n(&hist->total, __ATOMIC_RELAXED) == 0)
+            continue;
+        print_row(key < NUM_CATEGORIES ? news_categories[key] : "(other)", hist);
+        latency_merge(&all, hist);
+    }
+    if(all.total == 0)
+        printf("No stories published this session have been read yet\n");
+    else
+        print_row("ALL", &all);
+}
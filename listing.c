@@ -0,0 +1,93 @@
+#include "program.h"
+
+// Key of the all-news listing
+#define LISTING_ALL NUM_CATEGORIES
+
+void listing_init(ListingCache *cache){
+    memset(cache, 0, sizeof(*cache));
+    // Entries start at version 0, so nothing is current yet
+    for(int key = 0; key < LISTING_KEYS; key++)
+        cache->version[key] = 1;
+}
+
+// A story in category was added, changed, removed or moved (caller holds lock)
+void listing_invalidate(ListingCache *cache, uint8_t category){
+    if(category < NUM_CATEGORIES)
+        cache->version[category]++;
+    cache->version[LISTING_ALL]++;
+}
+
+void listing_invalidate_all(ListingCache *cache){
+    for(int key = 0; key < LISTING_KEYS; key++)
+        cache->version[key]++;
+}
+
+// Render the stories in category (CATEGORY_OTHER with name for an unknown
+// one, or all of them when name is NULL) the way the listings print them
+static void render(NewsDB *news_db, const char *name, Listing *out){
+    NewsStore *store = news_db->store;
+    uint8_t match[MAX_NEWS];
+    uint8_t cat = name ? news_category_index(name) : CATEGORY_OTHER;
+    if(name)
+        scan_category(store->category, MAX_NEWS, cat, match);
+
+    out->len = 0;
+    out->count = 0;
+    for(int i = 0; i < news_db->num_news; i++){
+        int index = (news_db->start + i) % MAX_NEWS;
+        if(name && (!match[index] || (cat == CATEGORY_OTHER && strcmp(store_category(store, index), name) != 0)))
+            continue;
+
+        char time_str[32];
+        struct tm tm_info;
+        localtime_r(&store->timestamp[index], &tm_info);
+        strftime(time_str, sizeof(time_str), "%a %b %d %H:%M:%S %Y", &tm_info);
+
+        size_t room = sizeof(out->text) - out->len;
+        int n;
+        if(name)
+            n = snprintf(out->text + out->len, room, "\nID: %d\nTime: %s\nTitle: %s\nContent: %s\n-------------------\n",
+                         store->id[index], time_str, store_title(store, index), store_content(store, index));
+        else
+            n = snprintf(out->text + out->len, room, "\nID: %d\nCategory: %s\nTime: %s\nTitle: %s\nContent: %s\n-------------------\n",
+                         store->id[index], store_category(store, index), time_str,
+                         store_title(store, index), store_content(store, index));
+        out->len += (size_t)n < room ? (size_t)n : room - 1;
+        out->slots[out->count++] = (uint8_t)index;
+    }
+    if(out->count == 0)
+        out->len = snprintf(out->text, sizeof(out->text), "%s\n",
+                            name ? "No news found in this category" : "No news available");
+}
+
+// Print the listing for category (NULL for all news), rendering it only if
+// something it shows has changed since last time, and count the reads.
+// Caller holds lock.
+void listing_show(NewsDB *news_db, const char *category){
+    ListingCache *cache = &news_db->listings;
+    uint8_t cat = category ? news_category_index(category) : LISTING_ALL;
+    static __thread Listing scratch;  // categories we don't know aren't cached
+    Listing *listing = cat < LISTING_KEYS ? &cache->listings[cat] : &scratch;
+
+    if(cat < LISTING_KEYS && listing->version == cache->version[cat]){
+        cache->hits++;
+    }else{
+        cache->misses++;
+        render(news_db, category, listing);
+        if(cat < LISTING_KEYS)
+            listing->version = cache->version[cat];
+    }
+    fwrite(listing->text, 1, listing->len, stdout);
+
+    uint32_t epoch = trend_epoch();
+    uint64_t now = latency_now_ns();
+    for(int i = 0; i < listing->count; i++){
+        trend_record(&news_db->trend, listing->slots[i], epoch);
+        latency_record_read(news_db, listing->slots[i], now);
+    }
+}
+
+double listing_hit_rate(const ListingCache *cache){
+    uint64_t total = cache->hits + cache->misses;
+    return total ? (double)cache->hits / total : 0.0;
+}
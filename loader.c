@@ -0,0 +1,464 @@
+#include "program.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define LOADER_SCANNER "sse2"
+#else
+#define LOADER_SCANNER "scalar"
+#endif
+
+// Files smaller than this per worker aren't worth splitting
+#define LOADER_MIN_CHUNK (256 * 1024)
+#define TIME_CACHE_SIZE 64
+#define TIME_LAYOUT_LEN 24  // "Www Mmm dd hh:mm:ss yyyy"
+
+// mktime() of the top of recently seen hours; stories cluster in time, so
+// most timestamps only need the minutes and seconds added
+typedef struct {
+    int64_t key[TIME_CACHE_SIZE];
+    time_t base[TIME_CACHE_SIZE];
+} TimeCache;
+
+typedef struct {
+    NewsSink sink;
+    void *arg;
+    TimeCache times;
+    size_t parsed;
+    int skipped;
+    long first_skip;  // byte offset of the first skipped line, -1 for none
+    const char *buf;
+} ParseState;
+
+// One slice of the file, parsed by one task; keeps only its newest stories
+typedef struct {
+    const char *buf;
+    const char *begin;
+    const char *end;
+    News recent[MAX_NEWS];
+    size_t count;
+    int skipped;
+    long first_skip;
+} LoadChunk;
+
+static const char weekdays[] = "SunMonTueWedThuFriSat";
+static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+static void copy_truncated(char *dst, size_t size, const char *src){
+    size_t len = strlen(src);
+    if(len > size - 1)
+        len = size - 1;
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+// The original line parser, kept as the reference the fast path is checked
+// against: same sscanf format and strptime check. Fields are scanned into
+// line-sized buffers and cut to fit, where the original overran them; a
+// field sscanf stops at leaves the time empty, so the line is rejected as
+// the original's uninitialized time string would have been.
+int parse_news_line_legacy(const char *line, News *out){
+    char small[4 * 1024];
+    size_t size = strlen(line) + 1;
+    char *scratch = size <= 1024 ? small : malloc(size * 4);
+    if(!scratch)
+        return -1;
+    if(scratch == small)
+        size = 1024;
+    char *category = scratch, *title = scratch + size, *content = scratch + 2 * size, *time_str = scratch + 3 * size;
+    category[0] = title[0] = content[0] = time_str[0] = '\0';
+    sscanf(line, "%d|%[^|]|%[^|]|%[^|]|%[^\n]", &out->id, category, title, content, time_str);
+
+    struct tm tm = {0};
+    int ok = strptime(time_str, "%a %b %d %H:%M:%S %Y", &tm) != NULL;
+    if(ok){
+        copy_truncated(out->category, sizeof(out->category), category);
+        copy_truncated(out->title, sizeof(out->title), title);
+        copy_truncated(out->content, sizeof(out->content), content);
+        out->timestamp = mktime(&tm);
+    }
+    if(scratch != small)
+        free(scratch);
+    return ok ? 0 : -1;
+}
+
+static int two_digits(const char *s, int *value){
+    if(s[0] < '0' || s[0] > '9' || s[1] < '0' || s[1] > '9')
+        return 0;
+    *value = (s[0] - '0') * 10 + (s[1] - '0');
+    return 1;
+}
+
+static int name_index(const char *names, int count, const char *s){
+    for(int i = 0; i < count; i++)
+        if(names[i * 3] == s[0] && names[i * 3 + 1] == s[1] && names[i * 3 + 2] == s[2])
+            return i;
+    return -1;
+}
+
+// Parse the exact layout save_news_to_file writes, giving the same result as
+// strptime + mktime. Returns 0 for anything else so the caller falls back.
+static int parse_time_fast(const char *s, size_t len, TimeCache *cache, time_t *out){
+    if(len < TIME_LAYOUT_LEN || s[3] != ' ' || s[7] != ' ' || s[10] != ' '
+       || s[13] != ':' || s[16] != ':' || s[19] != ' ')
+        return 0;
+
+    int mon = name_index(months, 12, s + 4);
+    int mday, hour, min, sec, hi, lo;
+    if(name_index(weekdays, 7, s) < 0 || mon < 0
+       || !two_digits(s + 8, &mday) || !two_digits(s + 11, &hour)
+       || !two_digits(s + 14, &min) || !two_digits(s + 17, &sec)
+       || !two_digits(s + 20, &hi) || !two_digits(s + 22, &lo))
+        return 0;
+    if(mday < 1 || mday > 31 || hour > 23 || min > 59 || sec > 59)
+        return 0;
+    int year = hi * 100 + lo;
+
+    int64_t key = (((int64_t)year * 12 + mon) * 32 + mday) * 24 + hour;
+    int slot = (int)((key ^ (key >> 6)) & (TIME_CACHE_SIZE - 1));
+    if(cache->key[slot] != key){
+        struct tm tm = {0};
+        tm.tm_year = year - 1900;
+        tm.tm_mon = mon;
+        tm.tm_mday = mday;
+        tm.tm_hour = hour;
+        cache->base[slot] = mktime(&tm);
+        cache->key[slot] = key;
+    }
+    if(cache->base[slot] == (time_t)-1)
+        return 0;
+    *out = cache->base[slot] + min * 60 + sec;
+    return 1;
+}
+
+// Fields may be empty: the agency and the importer both accept a blank
+// title or content
+static int copy_field(char *dst, size_t size, const char *begin, const char *end){
+    size_t len = (size_t)(end - begin);
+    if(len > size - 1)
+        len = size - 1;
+    memcpy(dst, begin, len);
+    dst[len] = '\0';
+    return 1;
+}
+
+static int parse_id(const char *begin, const char *end, int *id){
+    int negative = 0;
+    if(begin < end && (*begin == '-' || *begin == '+'))
+        negative = *begin++ == '-';
+    if(begin == end || end - begin > 9)
+        return 0;
+    int value = 0;
+    for(; begin < end; begin++){
+        if(*begin < '0' || *begin > '9')
+            return 0;
+        value = value * 10 + (*begin - '0');
+    }
+    *id = negative ? -value : value;
+    return 1;
+}
+
+// Fallback for lines off the fast path (" 5" for the day, full weekday
+// names...): the same fields, with the time left to strptime
+static int parse_line_slow(const char *line, News *out){
+    const char *delims[4];
+    const char *p = line;
+    for(int i = 0; i < 4; i++){
+        delims[i] = strchr(p, '|');
+        if(!delims[i])
+            return -1;
+        p = delims[i] + 1;
+    }
+    char *id_end;
+    long id = strtol(line, &id_end, 10);
+    if(id_end == line || id_end != delims[0])
+        return -1;
+    struct tm tm = {0};
+    if(!strptime(delims[3] + 1, "%a %b %d %H:%M:%S %Y", &tm))
+        return -1;
+
+    out->id = (int)id;
+    copy_field(out->category, sizeof(out->category), delims[0] + 1, delims[1]);
+    copy_field(out->title, sizeof(out->title), delims[1] + 1, delims[2]);
+    copy_field(out->content, sizeof(out->content), delims[2] + 1, delims[3]);
+    out->timestamp = mktime(&tm);
+    return 0;
+}
+
+// One complete line [line, eol) with the positions of its first four '|'
+static void parse_line(ParseState *st, const char *line, const char *eol, const char **delims, int num_delims){
+    if(line == eol)
+        return;
+
+    News news_item;
+    if(num_delims == 4
+       && parse_id(line, delims[0], &news_item.id)
+       && copy_field(news_item.category, sizeof(news_item.category), delims[0] + 1, delims[1])
+       && copy_field(news_item.title, sizeof(news_item.title), delims[1] + 1, delims[2])
+       && copy_field(news_item.content, sizeof(news_item.content), delims[2] + 1, delims[3])
+       && parse_time_fast(delims[3] + 1, (size_t)(eol - delims[3] - 1), &st->times, &news_item.timestamp)){
+        st->sink(&news_item, st->arg);
+        st->parsed++;
+        return;
+    }
+
+    // Unusual but possibly valid; with no memory to check, counted as skipped
+    size_t len = (size_t)(eol - line);
+    char *copy = malloc(len + 1);
+    if(copy){
+        memcpy(copy, line, len);
+        copy[len] = '\0';
+    }
+    if(copy && parse_line_slow(copy, &news_item) == 0){
+        st->sink(&news_item, st->arg);
+        st->parsed++;
+    }else{
+        if(st->skipped++ == 0)
+            st->first_skip = (long)(line - st->buf);
+    }
+    free(copy);
+}
+
+// One line for all the lines a parse skipped, printed by whoever started it
+static void report_skipped(const char *buf, int skipped, long first_skip){
+    if(skipped == 0)
+        return;
+    const char *line = buf + first_skip;
+    int len = (int)strcspn(line, "\n");
+    printf("[LOADER] Skipped %d malformed line%s, the first at byte %ld: %.*s\n",
+           skipped, skipped == 1 ? "" : "s", first_skip, len < 60 ? len : 60, line);
+}
+
+// Feed every story in buf[begin, end) to sink in file order. Lines may be any
+// length; the last one needs no trailing newline. Returns stories parsed;
+// adds the lines skipped to *skipped and notes where the first one was.
+static size_t parse_range(const char *buf, const char *begin, const char *end, NewsSink sink, void *arg, int *skipped, long *first_skip){
+    ParseState st;
+    st.sink = sink;
+    st.arg = arg;
+    st.parsed = 0;
+    st.skipped = 0;
+    st.first_skip = -1;
+    st.buf = buf;
+    for(int i = 0; i < TIME_CACHE_SIZE; i++)
+        st.times.key[i] = -1;
+
+    const char *line = begin;
+    const char *delims[4];
+    int num_delims = 0;
+    const char *p = begin;
+
+#ifdef __SSE2__
+    // 16 bytes at a time: one compare per delimiter, then walk the set bits
+    const __m128i pipe = _mm_set1_epi8('|');
+    const __m128i newline = _mm_set1_epi8('\n');
+    for(; end - p >= 16; p += 16){
+        __m128i block = _mm_loadu_si128((const __m128i *)p);
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, pipe),
+                                                                 _mm_cmpeq_epi8(block, newline)));
+        while(mask){
+            const char *hit = p + __builtin_ctz(mask);
+            mask &= mask - 1;
+            if(*hit == '\n'){
+                parse_line(&st, line, hit, delims, num_delims);
+                line = hit + 1;
+                num_delims = 0;
+            }else if(num_delims < 4){
+                delims[num_delims++] = hit;
+            }
+        }
+    }
+#endif
+    for(; p < end; p++){
+        if(*p == '\n'){
+            parse_line(&st, line, p, delims, num_delims);
+            line = p + 1;
+            num_delims = 0;
+        }else if(*p == '|' && num_delims < 4){
+            delims[num_delims++] = p;
+        }
+    }
+    if(line < end)
+        parse_line(&st, line, end, delims, num_delims);
+
+    if(skipped)
+        *skipped += st.skipped;
+    if(first_skip && st.skipped > 0 && *first_skip < 0)
+        *first_skip = st.first_skip;
+    return st.parsed;
+}
+
+size_t parse_news_text(const char *buf, size_t len, NewsSink sink, void *arg, int *skipped){
+    int count = 0;
+    long first_skip = -1;
+    size_t parsed = parse_range(buf, buf, buf + len, sink, arg, &count, &first_skip);
+    report_skipped(buf, count, first_skip);
+    if(skipped)
+        *skipped += count;
+    return parsed;
+}
+
+static void keep_recent(const News *news_item, void *arg){
+    LoadChunk *chunk = (LoadChunk *)arg;
+    chunk->recent[chunk->count % MAX_NEWS] = *news_item;
+    chunk->count++;
+}
+
+static void load_chunk_task(void *arg){
+    LoadChunk *chunk = (LoadChunk *)arg;
+    parse_range(chunk->buf, chunk->begin, chunk->end, keep_recent, chunk, &chunk->skipped, &chunk->first_skip);
+}
+
+// Append one story to the ring, dropping the oldest when it is full
+void load_news_item(NewsDB *news_db, const News *news_item){
+    if(news_db->num_news == MAX_NEWS){
+        news_db->start = (news_db->start + 1) % MAX_NEWS;
+        news_db->num_news--;
+    }
+    store_put(news_db->store, news_db->end, news_item);
+    news_db->end = (news_db->end + 1) % MAX_NEWS;
+    news_db->num_news++;
+}
+
+static double seconds_since(const struct timespec *start){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Parse the stories in buf, keeping the newest MAX_NEWS, without touching
+// any ring, so callers can parse before taking the store locks. Large
+// buffers are split at line boundaries and parsed in parallel on the executor.
+void parse_news_buffer(const char *buf, size_t len, ParsedNews *out){
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    Executor *ex = executor_default();
+    int num_chunks = (int)(len / LOADER_MIN_CHUNK);
+    if(num_chunks > ex->num_workers)
+        num_chunks = ex->num_workers;
+    if(num_chunks < 1)
+        num_chunks = 1;
+
+    // Without room for the chunk list, parse it all right here as one chunk
+    LoadChunk single;
+    LoadChunk *chunks = num_chunks > 1 ? malloc(num_chunks * sizeof(LoadChunk)) : NULL;
+    if(!chunks){
+        if(num_chunks > 1)
+            perror("Error splitting news for parallel parsing");
+        chunks = &single;
+        num_chunks = 1;
+    }
+    const char *begin = buf, *end = buf + len;
+    for(int i = 0; i < num_chunks; i++){
+        const char *stop = i == num_chunks - 1 ? end : buf + len / num_chunks * (i + 1);
+        if(stop < begin)
+            stop = begin;
+        while(stop < end && stop[-1] != '\n')
+            stop++;
+        chunks[i].buf = buf;
+        chunks[i].begin = begin;
+        chunks[i].end = stop;
+        chunks[i].count = 0;
+        chunks[i].skipped = 0;
+        chunks[i].first_skip = -1;
+        begin = stop;
+    }
+
+    if(num_chunks == 1){
+        load_chunk_task(&chunks[0]);
+    }else{
+        TaskGroup group;
+        task_group_init(&group);
+        for(int i = 0; i < num_chunks; i++)
+            executor_submit(ex, load_chunk_task, &chunks[i], &group);
+        task_group_wait(&group, -1);
+        task_group_destroy(&group);
+    }
+
+    size_t stories = 0;
+    int skipped = 0;
+    long first_skip = -1;
+    out->count = 0;
+    for(int i = 0; i < num_chunks; i++){
+        size_t keep = chunks[i].count < MAX_NEWS ? chunks[i].count : MAX_NEWS;
+        for(size_t j = chunks[i].count - keep; j < chunks[i].count; j++)
+            out->recent[out->count++ % MAX_NEWS] = chunks[i].recent[j % MAX_NEWS];
+        stories += chunks[i].count;
+        skipped += chunks[i].skipped;
+        if(first_skip < 0)
+            first_skip = chunks[i].first_skip;
+    }
+    if(chunks != &single)
+        free(chunks);
+    report_skipped(buf, skipped, first_skip);
+
+    LoadStats *stats = &out->stats;
+    stats->bytes = len;
+    stats->stories = stories;
+    stats->skipped = skipped;
+    stats->chunks = num_chunks;
+    stats->seconds = seconds_since(&started);
+}
+
+// Append what parse_news_buffer kept to the ring
+void load_parsed_news(NewsDB *news_db, const ParsedNews *parsed){
+    size_t keep = parsed->count < MAX_NEWS ? parsed->count : MAX_NEWS;
+    for(size_t j = parsed->count - keep; j < parsed->count; j++)
+        load_news_item(news_db, &parsed->recent[j % MAX_NEWS]);
+    news_db->last_load = parsed->stats;
+}
+
+// Append the stories in buf to the ring, keeping the newest MAX_NEWS
+int load_news_buffer(NewsDB *news_db, const char *buf, size_t len){
+    ParsedNews *parsed = malloc(sizeof(ParsedNews));
+    if(!parsed){
+        perror("Error loading news");
+        return 0;
+    }
+    parse_news_buffer(buf, len, parsed);
+    load_parsed_news(news_db, parsed);
+    int stories = (int)parsed->stats.stories;
+    free(parsed);
+    return stories;
+}
+
+// Rebuild the ring from the news file, which is mapped rather than read
+void load_news_from_file(NewsDB *news_db){
+    news_db->num_news = 0;
+    news_db->start = 0;
+    news_db->end = 0;
+    load_news_tail(news_db, 0);
+}
+
+// Add the stories after byte offset of the news file to the ring, e.g. the
+// part of the log a checkpoint doesn't cover yet
+void load_news_tail(NewsDB *news_db, uint64_t offset){
+    memset(&news_db->last_load, 0, sizeof(news_db->last_load));
+    news_db->log_bytes = offset;
+
+    FILE *file = news_file(news_db);
+    fflush(file);
+    int fd = fileno(file);
+    struct stat st;
+    if(fstat(fd, &st) < 0 || (uint64_t)st.st_size <= offset)
+        return;
+
+    size_t len = (size_t)st.st_size;
+    char *buf = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(buf == MAP_FAILED){
+        perror("Error mapping news file");
+        return;
+    }
+    posix_madvise(buf, len, POSIX_MADV_SEQUENTIAL);
+    load_news_buffer(news_db, buf + offset, len - offset);
+    checkpoint_note_tail(news_db, buf, len);
+    munmap(buf, len);
+    news_db->log_bytes = len;
+}
+
+const char *loader_scanner_name(void){
+    return LOADER_SCANNER;
+}
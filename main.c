@@ -1,8 +1,93 @@
 #include "program.h"
 
-int main() {
-    NewsDB db;
-    init_news_db(&db);
+static void usage(const char *prog) {
+    printf("Usage: %s [--shm NAME] [--record TRACE] [--primary SOCKET | --follow SOCKET]\n", prog);
+    printf("       %s --import FILE\n", prog);
+    printf("       %s --subscribe NAME\n", prog);
+    printf("       %s --replay TRACE [--fast] [--report FILE] [--baseline FILE]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char *shm_name = NULL, *subscribe_name = NULL, *record_path = NULL;
+    const char *replay_path = NULL, *report_path = NULL, *baseline_path = NULL;
+    const char *import_path = NULL, *primary_path = NULL, *follow_path = NULL;
+    int fast = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--fast") == 0) {
+            fast = 1;
+        } else if (i + 1 < argc && strcmp(argv[i], "--shm") == 0) {
+            shm_name = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--subscribe") == 0) {
+            subscribe_name = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--record") == 0) {
+            record_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--replay") == 0) {
+            replay_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--report") == 0) {
+            report_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--baseline") == 0) {
+            baseline_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--import") == 0) {
+            import_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--primary") == 0) {
+            primary_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--follow") == 0) {
+            follow_path = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (primary_path && follow_path) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Read-only subscriber process on a publisher's shared segment
+    if (subscribe_name) {
+        SharedNewsSegment *seg = attach_shared_news(subscribe_name);
+        if (!seg)
+            return 1;
+        shared_subscriber_thread(seg);
+        detach_shared_news(seg);
+        return 0;
+    }
+
+    // Re-run a recorded workload against a scratch database
+    if (replay_path) {
+        int status = replay_trace(replay_path, fast, report_path, baseline_path);
+        executor_shutdown(executor_default());
+        return status;
+    }
+
+    // Bulk-load a file of CATEGORY|Title|Content lines into the local database
+    if (import_path) {
+        static NewsDB import_db;
+        init_news_db(&import_db);
+        int status = import_news(&import_db, import_path) < 0;
+        close_news_db(&import_db);
+        executor_shutdown(executor_default());
+        return status;
+    }
+
+    NewsDB local_db;
+    NewsDB *db = &local_db;
+    if (shm_name) {
+        if (open_shared_news_db(db, shm_name) < 0)
+            return 1;
+    } else {
+        init_news_db(db);
+    }
+    if (record_path && trace_start(record_path, db) < 0)
+        return 1;
+
+    // Ship the log to followers, or be one: a follower runs in its own
+    // directory and serves reads of what the primary publishes
+    if (primary_path && replica_primary_start(db, primary_path) < 0)
+        return 1;
+    if (follow_path && replica_follow(db, follow_path) < 0)
+        return 1;
 
     int choice;
     while (1) {
@@ -17,20 +102,22 @@ int main() {
 
         switch (choice) {
         case 1:
-            run_demo(&db);
+            run_demo(db);
             break;
+        // Interactive sessions run right here; background work goes to the executor
         case 2:
-            pthread_t agency_tid;
-            pthread_create(&agency_tid, NULL, news_agency_thread, &db);
-            pthread_join(agency_tid, NULL);
+            news_agency_thread(db);
             break;
         case 3:
-            pthread_t subscriber_tid;
-            pthread_create(&subscriber_tid, NULL, subscriber_thread, &db);
-            pthread_join(subscriber_tid, NULL);
+            subscriber_thread(db);
             break;
         case 4:
-            close_news_db(&db);
+            trace_stop();
+            if (shm_name)
+                close_shared_news_db(db);
+            else
+                close_news_db(db);
+            executor_shutdown(executor_default());
             return 0;
         default:
             printf("Invalid choice\n");
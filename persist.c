@@ -0,0 +1,499 @@
+#define _GNU_SOURCE
+#include "program.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define NEWS_HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+// Most iovecs handed to a single vectored write
+#define PERSIST_MAX_IOV 64
+#define URING_ENTRIES 32
+
+#ifdef NEWS_HAVE_IO_URING
+// Minimal io_uring wrapper over the raw syscalls (no liburing needed)
+typedef struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    unsigned queued;
+} Uring;
+
+static Uring *uring_open(unsigned entries){
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if(fd < 0)
+        return NULL;
+
+    Uring *u = calloc(1, sizeof(Uring));
+    if(!u){
+        close(fd);
+        return NULL;
+    }
+    u->fd = fd;
+    u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP){
+        if(u->cq_ring_size > u->sq_ring_size)
+            u->sq_ring_size = u->cq_ring_size;
+        u->cq_ring_size = u->sq_ring_size;
+    }
+
+    u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(u->sq_ring == MAP_FAILED)
+        goto fail;
+    if(p.features & IORING_FEAT_SINGLE_MMAP){
+        u->cq_ring = u->sq_ring;
+    }else{
+        u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if(u->cq_ring == MAP_FAILED)
+            goto fail_sq;
+    }
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(u->sqes == MAP_FAILED)
+        goto fail_cq;
+
+    char *sq = u->sq_ring, *cq = u->cq_ring;
+    u->sq_head = (unsigned *)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(sq + p.sq_off.array);
+    u->cq_head = (unsigned *)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return u;
+
+fail_cq:
+    if(u->cq_ring != u->sq_ring)
+        munmap(u->cq_ring, u->cq_ring_size);
+fail_sq:
+    munmap(u->sq_ring, u->sq_ring_size);
+fail:
+    close(fd);
+    free(u);
+    return NULL;
+}
+
+static void uring_close(Uring *u){
+    munmap(u->sqes, u->sqes_size);
+    if(u->cq_ring != u->sq_ring)
+        munmap(u->cq_ring, u->cq_ring_size);
+    munmap(u->sq_ring, u->sq_ring_size);
+    close(u->fd);
+    free(u);
+}
+
+// Grab the next free SQE, zeroed, tagged with its position in the chain
+static struct io_uring_sqe *uring_sqe(Uring *u, unsigned char flags){
+    unsigned tail = *u->sq_tail + u->queued;
+    unsigned index = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->flags = flags;
+    sqe->user_data = u->queued;
+    u->sq_array[index] = index;
+    u->queued++;
+    return sqe;
+}
+
+// Submit everything queued and wait for all of it; res[i] gets each result
+static int uring_run(Uring *u, int *res){
+    unsigned count = u->queued;
+    __atomic_store_n(u->sq_tail, *u->sq_tail + count, __ATOMIC_RELEASE);
+    u->queued = 0;
+
+    unsigned reaped = 0;
+    while(reaped < count){
+        int ret = (int)syscall(__NR_io_uring_enter, u->fd, reaped == 0 ? count : 0, count - reaped, IORING_ENTER_GETEVENTS, NULL, 0);
+        if(ret < 0 && errno != EINTR)
+            return -1;
+
+        unsigned head = *u->cq_head;
+        unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+        while(head != tail){
+            struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+            if(cqe->user_data < count)
+                res[cqe->user_data] = cqe->res;
+            head++;
+            reaped++;
+        }
+        __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+#endif
+
+// Write the whole iovec array at offset, retrying on short writes
+static int pwritev_all(int fd, struct iovec *iov, int count, off_t offset){
+    while(count > 0){
+        ssize_t n = pwritev(fd, iov, count, offset);
+        if(n < 0){
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        offset += n;
+        while(count > 0 && (size_t)n >= iov->iov_len){
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if(count > 0){
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+static size_t iov_total(const struct iovec *iov, int count){
+    size_t total = 0;
+    for(int i = 0; i < count; i++)
+        total += iov[i].iov_len;
+    return total;
+}
+
+// Append a group of records and make them durable
+static int persist_append(PersistQueue *q, struct iovec *iov, int count){
+    size_t total = iov_total(iov, count);
+
+#ifdef NEWS_HAVE_IO_URING
+    if(q->backend == PERSIST_BACKEND_IO_URING){
+        Uring *u = q->uring;
+        int res[2] = {0, 0};
+        struct io_uring_sqe *sqe = uring_sqe(u, IOSQE_IO_LINK);
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->fd = q->fd;
+        sqe->addr = (unsigned long)iov;
+        sqe->len = count;
+        sqe->off = q->offset;
+        sqe = uring_sqe(u, 0);
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fd = q->fd;
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        if(uring_run(u, res) < 0)
+            return -1;
+
+        if(res[0] < 0){
+            errno = -res[0];
+            return -1;
+        }
+        if((size_t)res[0] < total){
+            // Short write: finish the tail synchronously
+            struct iovec rest[PERSIST_MAX_IOV];
+            memcpy(rest, iov, count * sizeof(struct iovec));
+            size_t skip = res[0];
+            int i = 0;
+            while(skip >= rest[i].iov_len){
+                skip -= rest[i].iov_len;
+                i++;
+            }
+            rest[i].iov_base = (char *)rest[i].iov_base + skip;
+            rest[i].iov_len -= skip;
+            if(pwritev_all(q->fd, rest + i, count - i, q->offset + res[0]) < 0 || fdatasync(q->fd) < 0)
+                return -1;
+        }else if(res[1] < 0){
+            errno = -res[1];
+            return -1;
+        }
+        q->offset += total;
+        return 0;
+    }
+#endif
+
+    if(pwritev_all(q->fd, iov, count, q->offset) < 0)
+        return -1;
+    if(fdatasync(q->fd) < 0)
+        return -1;
+    q->offset += total;
+    return 0;
+}
+
+// Replace the log with buf: write temp file, fsync, rename over the log, fsync
+// dir. Once the rename is done the new file is the log, even if the dir fsync
+// then fails.
+static int persist_rewrite(PersistQueue *q, const char *buf, size_t len){
+    int fd = open(q->temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0)
+        return -1;
+
+    int renamed = 0, status = 0;
+#ifdef NEWS_HAVE_IO_URING
+    if(q->backend == PERSIST_BACKEND_IO_URING){
+        Uring *u = q->uring;
+        int res[4] = {0, 0, 0, 0};
+        struct io_uring_sqe *sqe = uring_sqe(u, IOSQE_IO_LINK);
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = fd;
+        sqe->addr = (unsigned long)buf;
+        sqe->len = len;
+        sqe->off = 0;
+        sqe = uring_sqe(u, IOSQE_IO_LINK);
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fd = fd;
+        sqe = uring_sqe(u, IOSQE_IO_LINK);
+        sqe->opcode = IORING_OP_RENAMEAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (unsigned long)q->temp_path;
+        sqe->len = AT_FDCWD;
+        sqe->addr2 = (unsigned long)q->path;
+        sqe = uring_sqe(u, 0);
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fd = q->dir_fd;
+        if(uring_run(u, res) < 0 || res[0] < 0 || (size_t)res[0] != len || res[1] < 0){
+            close(fd);
+            unlink(q->temp_path);
+            return -1;
+        }
+        // Kernels without IORING_OP_RENAMEAT reject it (and so cancel the
+        // dir fsync linked to it); do both by hand below
+        renamed = res[2] >= 0;
+        if(renamed && res[3] < 0){
+            errno = -res[3];
+            status = -1;
+        }
+    }else
+#endif
+    {
+        struct iovec iov = {(void *)buf, len};
+        if(pwritev_all(fd, &iov, 1, 0) < 0 || fsync(fd) < 0){
+            close(fd);
+            unlink(q->temp_path);
+            return -1;
+        }
+    }
+
+    if(!renamed){
+        if(rename(q->temp_path, q->path) < 0){
+            close(fd);
+            unlink(q->temp_path);
+            return -1;
+        }
+        if(fsync(q->dir_fd) < 0)
+            status = -1;
+    }
+
+    // The temp fd now refers to the live log, keep appending through it
+    close(q->fd);
+    q->fd = fd;
+    q->offset = len;
+    return status;
+}
+
+// Run one batch in order. A rewrite holds the full store, so anything queued
+// before the last rewrite in the batch is already covered by it and skipped.
+static int persist_run_batch(PersistQueue *q, PersistJob *batch){
+    PersistJob *from = batch;
+    for(PersistJob *job = batch; job; job = job->next)
+        if(job->op == PERSIST_REWRITE)
+            from = job;
+
+    int status = 0;
+    struct iovec iov[PERSIST_MAX_IOV];
+    int count = 0;
+    for(PersistJob *job = from; job; job = job->next){
+        if(job->op == PERSIST_REWRITE){
+            if(persist_rewrite(q, job->buf, job->len) < 0){
+                perror("Error rewriting news file");
+                status = -1;
+            }
+            continue;
+        }
+        iov[count].iov_base = job->buf;
+        iov[count].iov_len = job->len;
+        if(++count == PERSIST_MAX_IOV || !job->next){
+            if(persist_append(q, iov, count) < 0){
+                perror("Error appending to news file");
+                status = -1;
+            }
+            count = 0;
+        }
+    }
+    return status;
+}
+
+static void free_jobs(PersistJob *job){
+    while(job){
+        PersistJob *next = job->next;
+        free(job->buf);
+        free(job);
+        job = next;
+    }
+}
+
+// Executor task: drains the queue batch by batch until it is empty. At most
+// one drain runs at a time, which keeps writes in submission order.
+static void persist_drain(void *arg){
+    PersistQueue *q = (PersistQueue *)arg;
+
+    pthread_mutex_lock(&q->mutex);
+    while(q->head){
+        PersistJob *batch = q->head;
+        q->head = q->tail = NULL;
+        uint64_t first = batch->ticket, last = q->next_ticket, rewrite = 0;
+        pthread_mutex_unlock(&q->mutex);
+
+        for(PersistJob *job = batch; job; job = job->next)
+            if(job->op == PERSIST_REWRITE)
+                rewrite = job->ticket;
+        int status = persist_run_batch(q, batch);
+        free_jobs(batch);
+
+        pthread_mutex_lock(&q->mutex);
+        if(status < 0){
+            if(!q->failed_from)
+                q->failed_from = first;
+            if(last > q->failed_last)
+                q->failed_last = last;
+        }else if(rewrite && q->failed_from && q->failed_from < rewrite){
+            // The rewrite replaced the whole file, so failures before it no
+            // longer count. One submitted since is only known to be newer.
+            q->failed_from = q->failed_last > rewrite ? rewrite + 1 : 0;
+        }
+        q->done_ticket = last;
+        pthread_cond_broadcast(&q->done_cond);
+    }
+    q->done_ticket = q->next_ticket;  // covers failed submits since the last batch
+    q->draining = 0;
+    pthread_cond_broadcast(&q->done_cond);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+// Open the log for appending; writes are drained on the executor
+int persist_init(PersistQueue *q, const char *path, Executor *executor){
+    memset(q, 0, sizeof(*q));
+    q->executor = executor;
+    snprintf(q->path, sizeof(q->path), "%s", path);
+    snprintf(q->temp_path, sizeof(q->temp_path), "%s.tmp", path);
+
+    q->fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if(q->fd < 0)
+        return -1;
+    q->offset = lseek(q->fd, 0, SEEK_END);
+
+    char dir[256];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char *slash = strrchr(dir, '/');
+    if(slash)
+        *slash = '\0';
+    q->dir_fd = open(slash ? dir : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    q->backend = PERSIST_BACKEND_PWRITEV;
+#ifdef NEWS_HAVE_IO_URING
+    // "thread" is the older name for the pwritev backend, still accepted
+    const char *env = getenv("NEWS_PERSIST_BACKEND");
+    if(!env || (strcmp(env, "pwritev") != 0 && strcmp(env, "thread") != 0)){
+        q->uring = uring_open(URING_ENTRIES);
+        if(q->uring)
+            q->backend = PERSIST_BACKEND_IO_URING;
+    }
+#endif
+
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->done_cond, NULL);
+    return 0;
+}
+
+// Wait for the queue to drain, then close the log
+void persist_close(PersistQueue *q){
+    pthread_mutex_lock(&q->mutex);
+    while(q->draining || q->head)
+        executor_cond_wait(&q->done_cond, &q->mutex);
+    pthread_mutex_unlock(&q->mutex);
+
+#ifdef NEWS_HAVE_IO_URING
+    if(q->uring)
+        uring_close(q->uring);
+#endif
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->done_cond);
+    close(q->fd);
+    if(q->dir_fd >= 0)
+        close(q->dir_fd);
+}
+
+// A write that never made it into the queue still gets a ticket, one that
+// waiting on reports as failed
+static uint64_t persist_fail(PersistQueue *q){
+    pthread_mutex_lock(&q->mutex);
+    uint64_t ticket = ++q->next_ticket;
+    if(!q->failed_from)
+        q->failed_from = ticket;
+    q->failed_last = ticket;
+    // Done already, unless a drain still has earlier writes to finish
+    if(!q->draining){
+        q->done_ticket = ticket;
+        pthread_cond_broadcast(&q->done_cond);
+    }
+    pthread_mutex_unlock(&q->mutex);
+    return ticket;
+}
+
+// Queue a write; takes ownership of buf. Returns the durability ticket. A
+// NULL buf (the caller ran out of memory building it) is queued as failed.
+uint64_t persist_submit(PersistQueue *q, PersistOp op, char *buf, size_t len){
+    PersistJob *job = buf ? malloc(sizeof(PersistJob)) : NULL;
+    if(!job){
+        free(buf);
+        return persist_fail(q);
+    }
+    job->op = op;
+    job->buf = buf;
+    job->len = len;
+    job->next = NULL;
+
+    pthread_mutex_lock(&q->mutex);
+    job->ticket = ++q->next_ticket;
+    if(q->tail)
+        q->tail->next = job;
+    else
+        q->head = job;
+    q->tail = job;
+    int start_drain = !q->draining;
+    q->draining = 1;
+    uint64_t ticket = job->ticket;
+    pthread_mutex_unlock(&q->mutex);
+
+    if(start_drain)
+        executor_submit(q->executor, persist_drain, q, NULL);
+    return ticket;
+}
+
+// Block until ticket is on disk; -1 if it or any write before it failed
+// (and no later rewrite has replaced the file since). Ticket 0 is nothing
+// queued, which is trivially durable.
+int persist_wait(PersistQueue *q, uint64_t ticket){
+    pthread_mutex_lock(&q->mutex);
+    while(q->done_ticket < ticket)
+        executor_cond_wait(&q->done_cond, &q->mutex);
+    int failed = q->failed_from && q->failed_from <= ticket;
+    pthread_mutex_unlock(&q->mutex);
+    return failed ? -1 : 0;
+}
+
+// Wait for everything queued so far
+int persist_flush(PersistQueue *q){
+    pthread_mutex_lock(&q->mutex);
+    uint64_t ticket = q->next_ticket;
+    pthread_mutex_unlock(&q->mutex);
+    return persist_wait(q, ticket);
+}
+
+const char *persist_backend_name(const PersistQueue *q){
+    return q->backend == PERSIST_BACKEND_IO_URING ? "io_uring" : "pwritev";
+}
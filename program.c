@@ -1,4 +1,5 @@
 #include "program.h"
+#include <sys/stat.h>
 #include <sys/time.h>
 
 // Global flag to signal demo completion
@@ -14,8 +15,29 @@ const char *news_categories[] = {
     "ENTERTAINMENT"
 };
 
+// Register every story in the ring with dedup; seeding isn't traffic, so
+// the lookup counters are left as they were
+static void seed_dedup(NewsDB *news_db){
+    uint64_t lookups = news_db->dedup.lookups, hits = news_db->dedup.hits;
+    for(int i=0; i < news_db->num_news; i++){
+        News news_item;
+        store_get(news_db->store, (news_db->start + i) % MAX_NEWS, &news_item);
+        dedup_seed(&news_db->dedup, &news_item);
+    }
+    news_db->dedup.lookups = lookups;
+    news_db->dedup.hits = hits;
+}
+
 // Initialize the news database with mutexes, semaphores, and file handles
 void init_news_db(NewsDB *news_db){
+    init_news_db_shared(news_db, NULL);
+}
+
+// Same, keeping the stories in a shared-memory ring when one is given
+void init_news_db_shared(NewsDB *news_db, SharedRing *ring){
+    news_db->shared = ring;
+    news_db->store = ring ? &ring->store : &news_db->local_store;
+    news_db->seq = 0;
     news_db->num_news = 0;
     news_db->start=0;
     news_db->end = 0;
@@ -26,9 +48,17 @@ void init_news_db(NewsDB *news_db){
     pthread_mutex_init(&news_db->lock, NULL);
     pthread_mutex_init(&news_db->rw_lock, NULL);
     pthread_mutex_init(&news_db->reader_lock, NULL);
-    pthread_mutex_init(&news_db->writer_lock, NULL);
-    sem_init(&news_db->free_slots, 0, MAX_NEWS);
     sem_init(&news_db->used_slots, 0, 0);
+    admission_init(&news_db->admission, 0);
+    ratelimit_init(&news_db->limits, 0);
+    memset(news_db->evicted, 0, sizeof(news_db->evicted));
+    listing_init(&news_db->listings);
+    latency_init(&news_db->latency);
+    fanout_init(&news_db->fanout, 0);
+    news_db->primary = NULL;
+    news_db->follower = NULL;
+    news_db->replica_epoch = 0;
+    news_db->replica_lsn = 0;
 
     strcpy(news_db->file_path, NEWS_FILE);
 
@@ -48,46 +78,142 @@ void init_news_db(NewsDB *news_db){
         fprintf(news_db->cat_file, "%s\n", news_categories[i]);
     fclose(news_db->cat_file);
 
-    load_news_from_file(news_db);
+    // Start from the latest checkpoint and the log after it when we can
+    dedup_init(&news_db->dedup, DEDUP_WINDOW_SECS, 0);
+    checkpoint_init(&news_db->checkpoint, CHECKPOINT_FILE);
+    int restored = checkpoint_restore(news_db) == 0;
+    if(!restored){
+        load_news_from_file(news_db);
+        news_db->next_id = 1;
+    }
+    trend_init(&news_db->trend);
+
+    // IDs continue after the newest story on file; readers may read those now
+    for(int i=0; i < news_db->num_news; i++){
+        int index = (news_db->start + i) % MAX_NEWS;
+        if(news_db->store->id[index] >= news_db->next_id)
+            news_db->next_id = news_db->store->id[index] + 1;
+        sem_post(&news_db->used_slots);
+    }
+
+    // Stories already on file count for dedup too
+    seed_dedup(news_db);
+    news_db->dedup.lookups = news_db->dedup.hits = 0; // seeding isn't traffic
+
+    // Writes go through the background persistence queue from here on
+    news_db->last_ticket = 0;
+    if(persist_init(&news_db->persist, NEWS_FILE, executor_default()) < 0){
+        perror("Error starting news persistence");
+        exit(1);
+    }
 }
 
 // Clean up the news database, destroying mutexes and closing files
 void close_news_db(NewsDB *news_db){
+    replica_close(news_db);  // a follower's last checkpoint includes its position
+    checkpoint_close(news_db);
+    persist_close(&news_db->persist);
     pthread_mutex_destroy(&news_db->lock);
     pthread_mutex_destroy(&news_db->rw_lock);
     pthread_mutex_destroy(&news_db->reader_lock);
-    pthread_mutex_destroy(&news_db->writer_lock);
-    sem_destroy(&news_db->free_slots);
     sem_destroy(&news_db->used_slots);
+    admission_destroy(&news_db->admission);
+    pthread_mutex_destroy(&news_db->limits.lock);
+    fanout_destroy(&news_db->fanout);
+    dedup_destroy(&news_db->dedup);
     fclose(news_db->file);
 }
 
-// Add a new news item to the circular buffer and file
-void add_news(NewsDB *news_db, const char *category, const char *title, const char *content, int writer_id){
+// news_db->file, reopened first if a rewrite has since renamed a new log
+// over the one it has open
+FILE *news_file(NewsDB *news_db){
+    struct stat open_st, path_st;
+    if(fstat(fileno(news_db->file), &open_st) == 0 && stat(news_db->file_path, &path_st) == 0
+       && open_st.st_ino == path_st.st_ino && open_st.st_dev == path_st.st_dev)
+        return news_db->file;
+    FILE *file = fopen(news_db->file_path, "a+");
+    if(!file){
+        perror("Error reopening news file");
+        return news_db->file;
+    }
+    fclose(news_db->file);
+    news_db->file = file;
+    return file;
+}
+
+// Followers only change by applying the primary's log
+static int read_only(NewsDB *news_db, const char *who){
+    if(!news_db->follower)
+        return 0;
+    printf("%s Read-only follower of %s: publish and edit on the primary\n", who, news_db->follower->path);
+    return 1;
+}
+
+// Seqlock around changes to the ring, so lock-free readers (checkpoints,
+// and subscriber processes on a shared ring, which get its bounds copied
+// here) can spot a torn read and retry. Called with lock held.
+void news_write_begin(NewsDB *news_db){
+    __atomic_store_n(&news_db->seq, news_db->seq + 1, __ATOMIC_RELAXED);
+    if(news_db->shared)
+        __atomic_store_n(&news_db->shared->seq, news_db->shared->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void news_write_end(NewsDB *news_db){
+    SharedRing *ring = news_db->shared;
+    if(ring){
+        __atomic_store_n(&ring->start, news_db->start, __ATOMIC_RELAXED);
+        __atomic_store_n(&ring->num_news, news_db->num_news, __ATOMIC_RELAXED);
+        __atomic_store_n(&ring->seq, ring->seq + 1, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&news_db->seq, news_db->seq + 1, __ATOMIC_RELEASE);
+}
+
+// Add a new news item to the circular buffer and file, returns its ID
+int add_news(NewsDB *news_db, const char *category, const char *title, const char *content, int writer_id){
     printf("\n[WRITER %d]'s trying to write...\n", writer_id);
+    if(read_only(news_db, "[WRITER]"))
+        return -1;
+    NewsPriority priority = news_priority(news_category_index(category));
+
+    // Publishers over their rate wait here, holding nothing
+    ratelimit_acquire(&news_db->limits, writer_id, 1);
+
+    // Drop repeats of a story we already have, before touching any lock
+    uint32_t now = (uint32_t)time(NULL);
+    uint64_t hash = dedup_hash(category, title, content);
+    int dedup_slot;
+    int existing_id;
+    while((existing_id = dedup_claim(&news_db->dedup, hash, now, &dedup_slot)) < 0)
+        dedup_wait(&news_db->dedup, dedup_slot, hash);  // same story, mid-publish
+    if(existing_id > 0){
+        printf("[WRITER %d] Duplicate of news ID %d, skipped\n", writer_id, existing_id);
+        trace_publish(existing_id, category, title, content, writer_id);
+        return existing_id;
+    }
 
-    // Ensure only one writer at a time
-    pthread_mutex_lock(&news_db->writer_lock);
+    // Ensure only one writer at a time; BREAKING stories go ahead of
+    // queued bulk ones
+    admission_enter(&news_db->admission, priority);
+    uint64_t published = latency_now_ns();  // the rate limit and queue aren't delivery time
 
-    // Check if buffer is nearing warning- warnign = 18
+    // Check if buffer is nearing warning- warnign = 18. Only the admitted
+    // writer adds stories, so after this there is always a free slot.
     pthread_mutex_lock(&news_db->lock);
     if(news_db->num_news>= WARN_THRESHOLD){
         pthread_mutex_unlock(&news_db->lock);
-        remove_oldest_news(news_db);
+        evict_news(news_db);
     }else{
         pthread_mutex_unlock(&news_db->lock);
     }
 
-    // Wait for an available slot in the buffer
-    sem_wait(&news_db->free_slots);
-
     pthread_mutex_lock(&news_db->rw_lock);
     printf("[WRITER %d] Got exclusive access\n", writer_id);
     news_db->is_writing= 1;
 
     News news_item;
-    static int next_id = 1;
-    news_item.id= __sync_fetch_and_add(&next_id, 1);
+    news_item.id= __sync_fetch_and_add(&news_db->next_id, 1);
+    dedup_publish(&news_db->dedup, dedup_slot, hash, news_item.id, now);
 
     strncpy(news_item.category, category, 19);
     news_item.category[19] = '\0';
@@ -108,12 +234,21 @@ void add_news(NewsDB *news_db, const char *category, const char *title, const ch
 
     // Add to circular buffer
     pthread_mutex_lock(&news_db->lock);
-    news_db->news[news_db->end] = news_item;
+    trace_publish(news_item.id, news_item.category, news_item.title, news_item.content, writer_id);
+    StoryRef ref = {news_item.id, news_db->end};
+    news_write_begin(news_db);
+    trend_reset_slot(&news_db->trend, news_db->end);
+    store_put(news_db->store, news_db->end, &news_item);
+    news_db->store->published_ns[news_db->end] = published;
+    listing_invalidate(&news_db->listings, news_db->store->category[news_db->end]);
     news_db->end = (news_db->end + 1) % MAX_NEWS; // Circular buffer wrap-around
     if(news_db->num_news < MAX_NEWS)
         news_db->num_news ++;
-
-    save_news_to_file(news_db, &news_item);
+    // The log write is queued inside the seqlock too, so a snapshot sees the
+    // ring and the log position that goes with it
+    news_db->last_ticket = save_news_to_file(news_db, &news_item);
+    news_write_end(news_db);
+    int want_checkpoint = __atomic_add_fetch(&news_db->checkpoint.since, 1, __ATOMIC_RELAXED) >= CHECKPOINT_EVERY;
 
     printf("\n[WRITER %d] News added!\n", writer_id);
     printf("ID: %d\n", news_item.id);
@@ -126,103 +261,119 @@ void add_news(NewsDB *news_db, const char *category, const char *title, const ch
     pthread_mutex_unlock(&news_db->rw_lock);
     printf("[WRITER %d] Released access\n", writer_id);
     news_db->is_writing =0;
-    pthread_mutex_unlock(&news_db->writer_lock);
+    admission_leave(&news_db->admission);
 
     sem_post(&news_db->used_slots);
+
+    // Deliver to subscriber queues outside the store locks
+    fanout_publish(&news_db->fanout, ref);
+    if(want_checkpoint)
+        checkpoint_start(news_db);
+    return news_item.id;
+}
+
+// Ring slot of the story to evict: the oldest one in the lowest priority
+// class present, so BREAKING stories only go when nothing else is left
+// (caller holds lock, buffer not empty)
+static int eviction_victim(NewsDB *news_db){
+    int victim = news_db->start;
+    int worst = -1;
+    for(int i = 0; i < news_db->num_news; i++){
+        int index = (news_db->start + i) % MAX_NEWS;
+        int priority = news_priority(news_db->store->category[index]);
+        if(priority > worst){
+            worst = priority;
+            victim = index;
+        }
+    }
+    return victim;
 }
 
-// Remove the oldest news item from the buffer and update the file
-void remove_oldest_news(NewsDB *news_db) {
+// Take the story in slot index out of the ring. The older stories each
+// move up one slot so the ring stays contiguous; evictions pick from the
+// old end, so that is usually only a few. Caller holds lock inside
+// news_write_begin.
+static void remove_story(NewsDB *news_db, int index){
+    news_db->evicted[news_priority(news_db->store->category[index])]++;
+    listing_invalidate(&news_db->listings, news_db->store->category[index]);
+    int offset = (index - news_db->start + MAX_NEWS) % MAX_NEWS;
+    for(int i = offset; i > 0; i--){
+        int dst = (news_db->start + i) % MAX_NEWS;
+        int src = (news_db->start + i - 1) % MAX_NEWS;
+        listing_invalidate(&news_db->listings, news_db->store->category[src]); // its slot changes
+        store_move(news_db->store, dst, src);
+        trend_move_slot(&news_db->trend, dst, src);
+    }
+    news_db->start = (news_db->start + 1) % MAX_NEWS; // Move start pointer
+    news_db->num_news--;
+}
+
+// Remove the oldest lowest-priority story from the buffer and update the file
+void evict_news(NewsDB *news_db) {
     pthread_mutex_lock(&news_db->lock);
 
     if(news_db->num_news > 0){
-        // Identify oldest news item
-        int index = news_db->start;
-        printf("\n[SYSTEM] Removing oldest news to make space:\n");
-        printf("ID: %d\n", news_db->news[index].id);
-        printf("Category: %s\n", news_db->news[index].category);
-        printf("Title: %s\n", news_db->news[index].title);
+        trace_evict(0);
+        int index = eviction_victim(news_db);
+        printf("\n[SYSTEM] Removing oldest %s news to make space:\n",
+               news_priority_name(news_priority(news_db->store->category[index])));
+        printf("ID: %d\n", news_db->store->id[index]);
+        printf("Category: %s\n", store_category(news_db->store, index));
+        printf("Title: %s\n", store_title(news_db->store, index));
 
         // Update circular buffer
-        news_db->start= (news_db->start + 1) % MAX_NEWS; // Move start pointer
-        news_db->num_news--;
-        sem_post(&news_db->free_slots);
-
+        news_write_begin(news_db);
+        remove_story(news_db, index);
         // Update news file to reflect sabse agay - curent buffer
-        FILE *temp = fopen("temp.txt", "w");
-        if(!temp) {
-            perror("Error creating temp file");
-            pthread_mutex_unlock(&news_db->lock);
-            return;
-        }
-
-        for(int i = 0; i<news_db->num_news; i++){
-            int current_index = (news_db->start + i) % MAX_NEWS;
-            char time_str[32];
-            struct tm *tm_info= localtime(&news_db->news[current_index].timestamp);
-            strftime(time_str, sizeof(time_str), "%a %b %d %H:%M:%S %Y", tm_info);
-
-            fprintf(temp, "%d|%s|%s|%s|%s\n",
-                    news_db->news[current_index].id,
-                    news_db->news[current_index].category,
-                    news_db->news[current_index].title,
-                    news_db->news[current_index].content,
-                    time_str);
-        }
+        news_db->last_ticket = save_news_snapshot(news_db);
+        news_write_end(news_db);
 
-        fclose(temp);
-        fclose(news_db->file);
-
-        remove(NEWS_FILE);
-        rename("temp.txt", NEWS_FILE);
+        printf("[SYSTEM] News removed and file updated. Current buffer size: %d/%d\n", news_db->num_news, MAX_NEWS);
+    }
 
-        news_db->file = fopen(NEWS_FILE, "a+");
-        if(!news_db->file){
-            perror("Error reopening news file");
-            pthread_mutex_unlock(&news_db->lock);
-            exit(1);
-        }
+    pthread_mutex_unlock(&news_db->lock);
+}
 
-        printf("[SYSTEM] News removed and file updated. Current buffer size: %d/%d\n", news_db->num_news, MAX_NEWS);
+// Ring index of the story with this ID, or -1 (caller holds lock).
+// Scans the dense id array; free slots may still hold old IDs, so skip those.
+static int find_news_index(NewsDB *news_db, int news_id){
+    long index = -1;
+    while((index = scan_find_id(news_db->store->id, MAX_NEWS, index + 1, news_id)) >= 0){
+        int offset = ((int)index - news_db->start + MAX_NEWS) % MAX_NEWS;
+        if(offset < news_db->num_news)
+            return (int)index;
     }
+    return -1;
+}
 
+// Copy out the story with this ID; 0 if it isn't in the buffer
+int get_news_by_id(NewsDB *news_db, int news_id, News *out){
+    pthread_mutex_lock(&news_db->lock);
+    int index = find_news_index(news_db, news_id);
+    if(index >= 0)
+        store_get(news_db->store, index, out);
     pthread_mutex_unlock(&news_db->lock);
+    return index >= 0;
 }
 
-// Edit an existing news item by ID
+// Edit an existing news item by ID, prompting for the new values
 void edit_news(NewsDB *news_db, int news_id){
     printf("\n[WRITER] Editing news...\n");
+    if(read_only(news_db, "[WRITER]"))
+        return;
 
-    pthread_mutex_lock(&news_db->writer_lock);
-    pthread_mutex_lock(&news_db->rw_lock);
-    printf("[WRITER] Got exclusive access\n");
-    news_db->is_writing = 1;
-
-    int is_found= 0, index = -1;
-    pthread_mutex_lock(&news_db->lock);
-    for(int i=0; i < news_db->num_news; i++){
-        if(news_db->news[i].id == news_id){
-            is_found = 1;
-            index= i;
-            break;
-        }
-    }
-
-    if(!is_found){
+    News current;
+    if(!get_news_by_id(news_db, news_id, &current)){
         printf("[WRITER] News not found\n");
-        pthread_mutex_unlock(&news_db->lock);
-        pthread_mutex_unlock(&news_db->rw_lock);
-        news_db->is_writing= 0;
-        pthread_mutex_unlock(&news_db->writer_lock);
         return;
     }
 
     // GEO NEWS - BREAKING NEWS!! --- just a display
     printf("\nCurrent news:\n");
-    printf("ID: %d\n", news_db->news[index].id);
-    printf("Category: %s\n", news_db->news[index].category);
-    printf("Title: %s\n", news_db->news[index].title);
-    printf("Content: %s\n", news_db->news[index].content);
+    printf("ID: %d\n", current.id);
+    printf("Category: %s\n", current.category);
+    printf("Title: %s\n", current.title);
+    printf("Content: %s\n", current.content);
     char new_title[MAX_LINE];
 
     char new_content[MAX_LINE];
@@ -242,64 +393,65 @@ void edit_news(NewsDB *news_db, int news_id){
     scanf("%d", &category);
     getchar();
 
-    if(strlen(new_title) > 0)
-        strncpy(news_db->news[index].title, new_title, MAX_LINE - 1);
-    if(strlen(new_content)>0)
-        strncpy(news_db->news[index].content, new_content, MAX_LINE-1);
-    if(category > 0 && category<= NUM_CATEGORIES)
-        strncpy(news_db->news[index].category, news_categories[category - 1], 19);
-
-    FILE *temp= fopen("temp.txt", "w");
-    if(!temp){
-        perror("Error creating temp file");
-        pthread_mutex_unlock(&news_db->lock);
-        pthread_mutex_unlock(&news_db->rw_lock);
-        news_db->is_writing = 0;
-        pthread_mutex_unlock(&news_db->writer_lock);
-        return;
-    }
-
-    for(int i=0; i < news_db->num_news; i++) {
-        char time_str[32];
-        struct tm *tm_info = localtime(&news_db->news[i].timestamp);
-        strftime(time_str, sizeof(time_str), "%a %b %d %H:%M:%S %Y", tm_info);
-
-        fprintf(temp, "%d|%s|%s|%s|%s\n",
-                news_db->news[i].id,
-                news_db->news[i].category,
-                news_db->news[i].title,
-                news_db->news[i].content,
-                time_str);
-    }
-
-    fclose(temp);
-    fclose(news_db->file);
+    if(apply_news_edit(news_db, news_id, new_title, new_content, category))
+        printf("\n[WRITER] News updated!\n");
+    else
+        printf("[WRITER] News was removed while editing\n");
+}
 
-    remove(NEWS_FILE);
-    rename("temp.txt", NEWS_FILE);
+// Apply an edit; an empty title/content or category 0 keeps the old value.
+// Returns 0 if the story is no longer in the buffer.
+int apply_news_edit(NewsDB *news_db, int news_id, const char *new_title, const char *new_content, int category){
+    if(read_only(news_db, "[WRITER]"))
+        return 0;
+    // Corrections queue in the lane of the story they correct
+    NewsPriority priority = PRIORITY_NORMAL;
+    pthread_mutex_lock(&news_db->lock);
+    int found = find_news_index(news_db, news_id);
+    if(found >= 0)
+        priority = news_priority(news_db->store->category[found]);
+    pthread_mutex_unlock(&news_db->lock);
+    admission_enter(&news_db->admission, priority);
+    pthread_mutex_lock(&news_db->rw_lock);
+    printf("[WRITER] Got exclusive access\n");
+    news_db->is_writing = 1;
 
-    news_db->file= fopen(NEWS_FILE, "a+");
-    if(!news_db->file) {
-        perror("Error reopening news file");
-        pthread_mutex_unlock(&news_db->lock);
-        pthread_mutex_unlock(&news_db->rw_lock);
-        news_db->is_writing=0;
-        pthread_mutex_unlock(&news_db->writer_lock);
-        return;
+    pthread_mutex_lock(&news_db->lock);
+    trace_edit(news_id, new_title, new_content, category);
+    int index = find_news_index(news_db, news_id);
+    if(index >= 0){
+        News news_item;
+        store_get(news_db->store, index, &news_item);
+        if(strlen(new_title) > 0)
+            snprintf(news_item.title, MAX_LINE, "%s", new_title);
+        if(strlen(new_content)>0)
+            snprintf(news_item.content, MAX_LINE, "%s", new_content);
+        if(category > 0 && category<= NUM_CATEGORIES)
+            snprintf(news_item.category, sizeof(news_item.category), "%s", news_categories[category - 1]);
+        news_write_begin(news_db);
+        listing_invalidate(&news_db->listings, news_db->store->category[index]);
+        uint64_t published = news_db->store->published_ns[index];
+        uint8_t counted = news_db->store->counted[index];
+        store_put(news_db->store, index, &news_item);
+        news_db->store->published_ns[index] = published;  // still the same story
+        news_db->store->counted[index] = counted;
+        listing_invalidate(&news_db->listings, news_db->store->category[index]);
+        news_db->last_ticket = save_news_snapshot(news_db);
+        news_write_end(news_db);
     }
 
-    printf("\n[WRITER] News updated!\n");
-
     pthread_mutex_unlock(&news_db->lock);
     pthread_mutex_unlock(&news_db->rw_lock);
     printf("[WRITER] Released access\n");
     news_db->is_writing = 0;
-    pthread_mutex_unlock(&news_db->writer_lock);
+    admission_leave(&news_db->admission);
+    return index >= 0;
 }
 
 // Display news items for a specific category
 void show_news_by_category(NewsDB *news_db, const char *category){
     printf("\n[READER] Reading news by category...\n");
+    trace_read_category(category);
 
     sem_wait(&news_db->used_slots);
 
@@ -310,27 +462,9 @@ void show_news_by_category(NewsDB *news_db, const char *category){
         pthread_mutex_lock(&news_db->rw_lock);
     pthread_mutex_unlock(&news_db->reader_lock);
 
+    // Reuses the rendered listing unless the category changed since
     pthread_mutex_lock(&news_db->lock);
-
-    int is_found = 0;
-    for(int i=0; i< news_db->num_news; i++){
-        int index = (news_db->start + i) % MAX_NEWS;
-        if(strcmp(news_db->news[index].category, category) == 0){
-            is_found= 1;
-            char time_str[32];
-            struct tm *tm_info = localtime(&news_db->news[index].timestamp);
-            strftime(time_str, sizeof(time_str), "%a %b %d %H:%M:%S %Y", tm_info);
-
-            printf("\nID: %d\n", news_db->news[index].id);
-            printf("Time: %s\n", time_str);
-            printf("Title: %s\n", news_db->news[index].title);
-            printf("Content: %s\n", news_db->news[index].content);
-            printf("-------------------\n");
-        }
-    }
-    if(!is_found)
-        printf("No news found in this category\n");
-
+    listing_show(news_db, category);
     pthread_mutex_unlock(&news_db->lock);
 
     pthread_mutex_lock(&news_db->reader_lock);
@@ -344,6 +478,7 @@ void show_news_by_category(NewsDB *news_db, const char *category){
 
 // Display all news items in the buffer
 void show_all_news(NewsDB *news_db) {
+    trace_read_all();
     pthread_mutex_lock(&news_db->reader_lock);
     news_db->num_readers++;
     if(news_db->num_readers==1)
@@ -353,21 +488,7 @@ void show_all_news(NewsDB *news_db) {
     printf("\n=== All News ===\n");
 
     pthread_mutex_lock(&news_db->lock);
-    for(int i = 0; i<news_db->num_news; i++){
-        int index= (news_db->start + i) % MAX_NEWS;
-        char time_str[32];
-        struct tm *tm_info= localtime(&news_db->news[index].timestamp);
-        strftime(time_str, sizeof(time_str), "%a %b %d %H:%M:%S %Y", tm_info);
-
-        printf("\nID: %d\n", news_db->news[index].id);
-        printf("Category: %s\n", news_db->news[index].category);
-        printf("Time: %s\n", time_str);
-        printf("Title: %s\n", news_db->news[index].title);
-        printf("Content: %s\n", news_db->news[index].content);
-        printf("-------------------\n");
-    }
-    if(news_db->num_news == 0)
-        printf("No news available\n");
+    listing_show(news_db, NULL);
     pthread_mutex_unlock(&news_db->lock);
 
     pthread_mutex_lock(&news_db->reader_lock);
@@ -377,46 +498,491 @@ void show_all_news(NewsDB *news_db) {
     pthread_mutex_unlock(&news_db->reader_lock);
 }
 
-// Save a single news item to the file
-void save_news_to_file(NewsDB *news_db, News *news_item){
+// Format one news item as a line of the news file with its time already
+// formatted, returns its length
+static int format_news_line_at(const News *news_item, const char *time_str, char *line, size_t size){
+    return snprintf(line, size, "%d|%s|%s|%s|%s\n",
+                    news_item->id,
+                    news_item->category,
+                    news_item->title,
+                    news_item->content,
+                    time_str);
+}
+
+// Format one news item as a line of the news file, returns its length
+static int format_news_line(const News *news_item, char *line, size_t size){
     char time_str[32];
-    struct tm *tm_info = localtime(&news_item->timestamp);
-    strftime(time_str, sizeof(time_str), "%a %b %d %H:%M:%S %Y", tm_info);
+    struct tm tm_info;
+    localtime_r(&news_item->timestamp, &tm_info);
+    strftime(time_str, sizeof(time_str), "%a %b %d %H:%M:%S %Y", &tm_info);
+    return format_news_line_at(news_item, time_str, line, size);
+}
 
-    fprintf(news_db->file, "%d|%s|%s|%s|%s\n",
-            news_item->id,
-            news_item->category,
-            news_item->title,
-            news_item->content,
-            time_str);
-    fflush(news_db->file);
+// Queue a single news item for appending to the file, returns its durability ticket
+uint64_t save_news_to_file(NewsDB *news_db, News *news_item){
+    char line[MAX_LINE * 3 + 64];
+    int len = format_news_line(news_item, line, sizeof(line));
+    if(len >= (int)sizeof(line))
+        len = sizeof(line) - 1;
+
+    char *buf = malloc(len);
+    if(!buf){
+        perror("Error queueing news item");
+        replica_log(news_db, REPLICA_APPEND, NULL, 0);
+        return persist_submit(&news_db->persist, PERSIST_APPEND, NULL, 0);
+    }
+    memcpy(buf, line, len);
+    news_db->log_bytes += len;
+    checkpoint_note_tail(news_db, buf, len);
+    replica_log(news_db, REPLICA_APPEND, buf, len);
+    return persist_submit(&news_db->persist, PERSIST_APPEND, buf, len);
 }
 
-// Load news items from the file into the buffer
-void load_news_from_file(NewsDB *news_db){
-    rewind(news_db->file);
-    char line[1024];
+// The current buffer formatted as the news file, in a malloc'd buffer of
+// *len bytes; NULL if out of memory (caller holds lock)
+char *format_news_snapshot(NewsDB *news_db, size_t *len){
+    size_t cap = (size_t)(news_db->num_news > 0 ? news_db->num_news : 1) * (MAX_LINE * 3 + 64);
+    char *buf = malloc(cap);
+    if(!buf)
+        return NULL;
 
-    while(fgets(line, sizeof(line), news_db->file)){
+    *len = 0;
+    for(int i = 0; i<news_db->num_news; i++){
+        int current_index = (news_db->start + i) % MAX_NEWS;
         News news_item;
-        char time_str[32];
+        store_get(news_db->store, current_index, &news_item);
+        *len += format_news_line(&news_item, buf + *len, cap - *len);
+    }
+    return buf;
+}
+
+// Queue a rewrite of the whole file from the current buffer (caller holds lock)
+uint64_t save_news_snapshot(NewsDB *news_db){
+    size_t len;
+    char *buf = format_news_snapshot(news_db, &len);
+    if(!buf){
+        perror("Error queueing news snapshot");
+        replica_log(news_db, REPLICA_REWRITE, NULL, 0);
+        return persist_submit(&news_db->persist, PERSIST_REWRITE, NULL, 0);
+    }
+    news_db->log_bytes = len;
+    checkpoint_note_tail(news_db, buf, len);
+    replica_log(news_db, REPLICA_REWRITE, buf, len);
+    return persist_submit(&news_db->persist, PERSIST_REWRITE, buf, len);
+}
+
+// Send followers the whole buffer after a change that doesn't rewrite our
+// own file (caller holds lock). Out of memory the record is a gap, so they
+// still resync.
+static void replica_log_snapshot(NewsDB *news_db){
+    if(!news_db->primary)
+        return;
+    size_t len = 0;
+    char *buf = format_news_snapshot(news_db, &len);
+    replica_log(news_db, REPLICA_REWRITE, buf, len);
+    free(buf);
+}
+
+// Block until everything this database has queued so far is on disk
+int wait_news_durable(NewsDB *news_db){
+    pthread_mutex_lock(&news_db->lock);
+    uint64_t ticket = news_db->last_ticket;
+    pthread_mutex_unlock(&news_db->lock);
+    return persist_wait(&news_db->persist, ticket);
+}
+
+// A draft's dedup hash, for claiming in hash order
+typedef struct {
+    uint64_t hash;
+    int index;
+} DraftKey;
+
+static int compare_draft_keys(const void *a, const void *b){
+    const DraftKey *x = (const DraftKey *)a, *y = (const DraftKey *)b;
+    if(x->hash != y->hash)
+        return x->hash < y->hash ? -1 : 1;
+    return x->index - y->index;
+}
 
-        sscanf(line, "%d|%[^|]|%[^|]|%[^|]|%[^\n]",
-               &news_item.id,
-               news_item.category,
-               news_item.title,
-               news_item.content,
-               time_str);
-
-        struct tm tm = {0};
-        char *result= strptime(time_str, "%a %b %d %H:%M:%S %Y", &tm);
-        if(!result){
-            printf("Error parsing time: %s\n", time_str);
+// Publish count stories in one go: one rate-limit charge, one admission,
+// one lock round, one eviction step and one log write. Room is made as if
+// the whole batch arrived at once, so the batch's own older low-priority
+// stories can be the ones dropped; those get no ID (ids[i] is 0) and give
+// their dedup claims back. ids[i] gets each story's ID (the existing one for a duplicate).
+// Returns how many stories were new. Only charges writer_id's rate limit
+// when throttle is set.
+static int publish_batch(NewsDB *news_db, const NewsDraft *drafts, int count, int *ids, int writer_id, int throttle){
+    if(count <= 0 || read_only(news_db, "[WRITER]"))
+        return 0;
+    if(throttle)
+        ratelimit_acquire(&news_db->limits, writer_id, count);
+
+    // Dedup first, holding nothing. A story repeated inside the batch would
+    // wait forever on its own pending claim, so match those by hash here.
+    uint32_t now = (uint32_t)time(NULL);
+    uint64_t *hashes = malloc(count * sizeof(uint64_t));
+    int *claims = malloc(count * sizeof(int));
+    int *copy_of = malloc(count * sizeof(int));
+    int *pending = malloc(count * sizeof(int));
+    uint8_t *priorities = malloc(count);
+    DraftKey *keys = malloc(count * sizeof(DraftKey));
+    if(!hashes || !claims || !copy_of || !pending || !priorities || !keys){
+        perror("Error publishing news batch");
+        free(hashes);
+        free(claims);
+        free(copy_of);
+        free(pending);
+        free(priorities);
+        free(keys);
+        return 0;
+    }
+
+    for(int i = 0; i < count; i++){
+        hashes[i] = dedup_hash(drafts[i].category, drafts[i].title, drafts[i].content);
+        priorities[i] = news_priority(news_category_index(drafts[i].category));
+        claims[i] = -1;
+        copy_of[i] = -1;
+        ids[i] = 0;
+        keys[i].hash = hashes[i];
+        keys[i].index = i;
+    }
+
+    // Claim in hash order. Batches holding the same stories in a different
+    // order would otherwise each wait on the other's pending claim. Repeats
+    // end up next to each other, earliest first.
+    qsort(keys, count, sizeof(DraftKey), compare_draft_keys);
+    int fresh = 0, deferred = 0;
+    int new_in[NUM_PRIORITIES] = {0};
+    NewsPriority lane = PRIORITY_BULK;
+    for(int k = 0; k < count; k++){
+        int i = keys[k].index;
+        if(k > 0 && keys[k - 1].hash == keys[k].hash){
+            int j = keys[k - 1].index;
+            if(copy_of[j] >= 0)
+                copy_of[i] = copy_of[j];
+            else if(claims[j] >= 0)
+                copy_of[i] = j;
+        }
+        if(copy_of[i] >= 0)
+            continue;
+        int existing_id = dedup_claim(&news_db->dedup, hashes[i], now, &claims[i]);
+        if(existing_id > 0){
+            ids[i] = existing_id;
+            continue;
+        }
+        if(existing_id < 0){
+            // Someone else is publishing this story right now. Waiting here
+            // would hold our other claims, so it follows once they're done.
+            pending[i] = claims[i];
+            claims[i] = -1;
+            ids[i] = -1;
+            deferred++;
             continue;
         }
-        news_item.timestamp= mktime(&tm);
+        fresh++;
+        new_in[priorities[i]]++;
+        if(priorities[i] < lane)
+            lane = priorities[i];
+    }
 
-        news_db->news[news_db->num_news++] = news_item;
+    // Room for the new stories' log lines and feed references; without it,
+    // give the claims back rather than store stories we can't log
+    size_t line_cap = MAX_LINE * 3 + 64;
+    char *buf = malloc(line_cap * (fresh > 0 ? fresh : 1));
+    StoryRef *refs = malloc((fresh > 0 ? fresh : 1) * sizeof(StoryRef));
+    if(!buf || !refs){
+        perror("Error publishing news batch");
+        for(int i = 0; i < count; i++)
+            dedup_abandon(&news_db->dedup, claims[i]);
+        free(buf);
+        free(refs);
+        free(hashes);
+        free(claims);
+        free(copy_of);
+        free(pending);
+        free(priorities);
+        free(keys);
+        return 0;
+    }
+
+    admission_enter(&news_db->admission, lane);
+    uint64_t published = latency_now_ns();
+    pthread_mutex_lock(&news_db->rw_lock);
+    news_db->is_writing = 1;
+    pthread_mutex_lock(&news_db->lock);
+
+    // Same end state as fresh add_news calls: the buffer grows to
+    // WARN_THRESHOLD, then each story costs one eviction. Drop the lowest
+    // classes first, and within a class the buffer's stories before the
+    // batch's.
+    int old_in[NUM_PRIORITIES] = {0};
+    for(int i = 0; i < news_db->num_news; i++)
+        old_in[news_priority(news_db->store->category[(news_db->start + i) % MAX_NEWS])]++;
+    int final = news_db->num_news + fresh;
+    if(final > WARN_THRESHOLD)
+        final = news_db->num_news > WARN_THRESHOLD ? news_db->num_news : WARN_THRESHOLD;
+    int drop = news_db->num_news + fresh - final;
+    int drop_old = 0, dropped = 0, drop_new[NUM_PRIORITIES] = {0};
+    for(int p = NUM_PRIORITIES - 1; p >= 0 && drop > 0; p--){
+        int n = old_in[p] < drop ? old_in[p] : drop;
+        drop_old += n;
+        drop -= n;
+        drop_new[p] = new_in[p] < drop ? new_in[p] : drop;
+        drop -= drop_new[p];
+        dropped += drop_new[p];
+    }
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    char time_str[32];
+    struct tm tm_info;
+    localtime_r(&tv.tv_sec, &tm_info);
+    strftime(time_str, sizeof(time_str), "%a %b %d %H:%M:%S %Y", &tm_info);
+
+    int first_id = __sync_fetch_and_add(&news_db->next_id, fresh - dropped);
+    int next = first_id, kept = 0;
+    size_t len = 0;
+
+    news_write_begin(news_db);
+    for(int i = 0; i < drop_old; i++){
+        trace_evict(0);
+        remove_story(news_db, eviction_victim(news_db));
+    }
+    for(int i = 0; i < count; i++){
+        if(copy_of[i] >= 0){
+            ids[i] = ids[copy_of[i]];
+            if(ids[i] == 0)
+                continue;
+            trace_publish(ids[i], drafts[i].category, drafts[i].title, drafts[i].content, writer_id);
+            continue;
+        }
+        if(ids[i] < 0)
+            continue;
+        if(ids[i] > 0){
+            trace_publish(ids[i], drafts[i].category, drafts[i].title, drafts[i].content, writer_id);
+            continue;
+        }
+        if(drop_new[priorities[i]] > 0){
+            // Never stored, so nothing for a later copy to match against
+            drop_new[priorities[i]]--;
+            dedup_abandon(&news_db->dedup, claims[i]);
+            news_db->evicted[priorities[i]]++;
+            continue;
+        }
+        News news_item;
+        news_item.id = ids[i] = next++;
+        news_item.timestamp = tv.tv_sec;
+        snprintf(news_item.category, sizeof(news_item.category), "%s", drafts[i].category);
+        snprintf(news_item.title, MAX_LINE, "%s", drafts[i].title);
+        snprintf(news_item.content, MAX_LINE, "%s", drafts[i].content);
+        dedup_publish(&news_db->dedup, claims[i], hashes[i], news_item.id, now);
+        trace_publish(news_item.id, news_item.category, news_item.title, news_item.content, writer_id);
+
+        refs[kept].id = news_item.id;
+        refs[kept].slot = news_db->end;
+        kept++;
+        trend_reset_slot(&news_db->trend, news_db->end);
+        store_put(news_db->store, news_db->end, &news_item);
+        news_db->store->published_ns[news_db->end] = published;
+        listing_invalidate(&news_db->listings, news_db->store->category[news_db->end]);
+        news_db->end = (news_db->end + 1) % MAX_NEWS;
+        news_db->num_news++;
+        int n = format_news_line_at(&news_item, time_str, buf + len, line_cap);
+        len += n < (int)line_cap ? (size_t)n : line_cap - 1;
+    }
+
+    // One write either way: the whole file when older stories left, else
+    // the new lines appended
+    if(drop_old > 0){
+        free(buf);
+        news_db->last_ticket = save_news_snapshot(news_db);
+    }else if(len > 0){
+        news_db->log_bytes += len;
+        checkpoint_note_tail(news_db, buf, len);
+        replica_log(news_db, REPLICA_APPEND, buf, len);
+        news_db->last_ticket = persist_submit(&news_db->persist, PERSIST_APPEND, buf, len);
+    }else{
+        free(buf);
+    }
+    news_write_end(news_db);
+    int want_checkpoint = __atomic_add_fetch(&news_db->checkpoint.since, fresh, __ATOMIC_RELAXED) >= CHECKPOINT_EVERY;
+
+    pthread_mutex_unlock(&news_db->lock);
+    news_db->is_writing = 0;
+    pthread_mutex_unlock(&news_db->rw_lock);
+    admission_leave(&news_db->admission);
+
+    if(kept > 0)
+        printf("[WRITER %d] Batch of %d: %d new (IDs %d-%d), %d duplicates, %d dropped\n",
+               writer_id, count, fresh, first_id, first_id + kept - 1, count - fresh - deferred, dropped);
+    else if(fresh > 0)
+        printf("[WRITER %d] Batch of %d: %d new, all dropped to make room\n", writer_id, count, fresh);
+    else if(deferred < count)
+        printf("[WRITER %d] Batch of %d: no new stories, all duplicates\n", writer_id, count - deferred);
+    if(deferred > 0)
+        printf("[WRITER %d] %d stories were mid-publish elsewhere, retrying them\n", writer_id, deferred);
+    for(int i = 0; i < kept; i++){
+        sem_post(&news_db->used_slots);
+        fanout_publish(&news_db->fanout, refs[i]);
+    }
+    if(want_checkpoint)
+        checkpoint_start(news_db);
+
+    // Our claims are all settled, so now it is safe to wait on the others'.
+    // In-batch repeats of a deferred story were deferred too and come out as
+    // its duplicates here.
+    for(int i = 0; i < count && deferred > 0; i++){
+        if(ids[i] >= 0)
+            continue;
+        dedup_wait(&news_db->dedup, pending[i], hashes[i]);
+        fresh += publish_batch(news_db, &drafts[i], 1, &ids[i], writer_id, 0);
+    }
+
+    free(refs);
+    free(hashes);
+    free(claims);
+    free(copy_of);
+    free(pending);
+    free(priorities);
+    free(keys);
+    return fresh;
+}
+
+int add_news_batch(NewsDB *news_db, const NewsDraft *drafts, int count, int *ids, int writer_id){
+    return publish_batch(news_db, drafts, count, ids, writer_id, 1);
+}
+
+// Bulk importer: publish every "CATEGORY|Title|Content" line of path in
+// batches of IMPORT_BATCH. Returns how many stories were new, or -1.
+int import_news(NewsDB *news_db, const char *path){
+    FILE *file = fopen(path, "r");
+    if(!file){
+        perror("Error opening import file");
+        return -1;
+    }
+
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    char (*lines)[MAX_LINE * 3] = malloc(IMPORT_BATCH * sizeof(*lines));
+    if(!lines){
+        perror("Error importing news");
+        fclose(file);
+        return -1;
+    }
+    NewsDraft drafts[IMPORT_BATCH];
+    int ids[IMPORT_BATCH];
+    int pending = 0, total = 0, fresh = 0, malformed = 0;
+    while(1){
+        char *line = lines[pending];
+        int more = fgets(line, sizeof(lines[0]), file) != NULL;
+        if(more){
+            line[strcspn(line, "\r\n")] = '\0';
+            char *title = strchr(line, '|');
+            char *content = title ? strchr(title + 1, '|') : NULL;
+            if(!content || title == line){
+                if(line[0])
+                    malformed++;
+                continue;
+            }
+            *title++ = '\0';
+            *content++ = '\0';
+            drafts[pending].category = line;
+            drafts[pending].title = title;
+            drafts[pending].content = content;
+            pending++;
+        }
+        if(pending == IMPORT_BATCH || (!more && pending > 0)){
+            // An operator's import isn't a publisher to throttle
+            fresh += publish_batch(news_db, drafts, pending, ids, 0, 0);
+            total += pending;
+            pending = 0;
+        }
+        if(!more)
+            break;
+    }
+    fclose(file);
+    free(lines);
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+
+    printf("[IMPORT] %d stories from %s (%d new, %d duplicates, %d malformed lines) in %.2f ms\n",
+           total, path, fresh, total - fresh, malformed,
+           (finished.tv_sec - started.tv_sec) * 1e3 + (finished.tv_nsec - started.tv_nsec) / 1e6);
+    return fresh;
+}
+
+// Copy out the story a delivery refers to; 0 if it has since been evicted
+int read_story_ref(NewsDB *news_db, StoryRef ref, News *out){
+    trace_read_story(ref);
+    int found = 0;
+    pthread_mutex_lock(&news_db->lock);
+    if(ref.slot >= 0 && ref.slot < MAX_NEWS && news_db->num_news > 0){
+        // An eviction may have moved the story up a slot since
+        int slot = ref.slot;
+        int offset = (slot - news_db->start + MAX_NEWS) % MAX_NEWS;
+        if(offset >= news_db->num_news || news_db->store->id[slot] != ref.id)
+            slot = find_news_index(news_db, ref.id);
+        if(slot >= 0){
+            store_get(news_db->store, slot, out);
+            trend_record(&news_db->trend, slot, trend_epoch());
+            latency_record_read(news_db, slot, latency_now_ns());
+            found = 1;
+        }
+    }
+    pthread_mutex_unlock(&news_db->lock);
+    return found;
+}
+
+// Print runtime counters for the store
+void show_news_stats(NewsDB *news_db){
+    printf("\n=== News Stats ===\n");
+    printf("Stories in buffer: %d/%d\n", news_db->num_news, MAX_NEWS);
+    printf("Persistence backend: %s\n", persist_backend_name(&news_db->persist));
+    LoadStats *load = &news_db->last_load;
+    if(load->bytes > 0)
+        printf("Last load: %llu stories from %.1f MB in %.2f ms (%.2f GB/s, %d chunks, %s scanner)\n",
+               (unsigned long long)load->stories, load->bytes / 1e6, load->seconds * 1e3,
+               load->seconds > 0 ? load->bytes / load->seconds / 1e9 : 0.0, load->chunks,
+               loader_scanner_name());
+    pthread_mutex_lock(&news_db->checkpoint.mutex);
+    if(news_db->checkpoint.written > 0)
+        printf("Checkpoints: %llu written, last covers %llu bytes of log (%.2f ms)\n",
+               (unsigned long long)news_db->checkpoint.written,
+               (unsigned long long)news_db->checkpoint.last_offset, news_db->checkpoint.last_ms);
+    pthread_mutex_unlock(&news_db->checkpoint.mutex);
+    AdmissionQueue *adm = &news_db->admission;
+    pthread_mutex_lock(&adm->lock);
+    for(int p = 0; p < NUM_PRIORITIES; p++)
+        if(adm->admitted[p] > 0)
+            printf("Lane %s: %llu admitted, %llu queued, wait avg %.3f ms max %.3f ms, %llu evicted\n",
+                   news_priority_name(p), (unsigned long long)adm->admitted[p],
+                   (unsigned long long)adm->queued[p], adm->wait_ns[p] / 1e6 / adm->admitted[p],
+                   adm->max_wait_ns[p] / 1e6, (unsigned long long)news_db->evicted[p]);
+    pthread_mutex_unlock(&adm->lock);
+    pthread_mutex_lock(&news_db->limits.lock);
+    if(news_db->limits.rate > 0)
+        printf("Publish limit: %.0f stories/s per publisher, %llu throttled (%.1f ms waited)\n",
+               news_db->limits.rate, (unsigned long long)news_db->limits.throttled,
+               news_db->limits.throttled_ns / 1e6);
+    pthread_mutex_unlock(&news_db->limits.lock);
+    pthread_mutex_lock(&news_db->lock);
+    printf("Listing cache: %llu hits, %llu renders (hit rate %.1f%%)\n",
+           (unsigned long long)news_db->listings.hits, (unsigned long long)news_db->listings.misses,
+           listing_hit_rate(&news_db->listings) * 100.0);
+    pthread_mutex_unlock(&news_db->lock);
+    printf("Dedup lookups: %llu, duplicates: %llu (hit rate %.1f%%)\n",
+           (unsigned long long)__atomic_load_n(&news_db->dedup.lookups, __ATOMIC_RELAXED),
+           (unsigned long long)__atomic_load_n(&news_db->dedup.hits, __ATOMIC_RELAXED),
+           dedup_hit_rate(&news_db->dedup) * 100.0);
+    replica_show_stats(news_db);
+    for(int i = 0; i < MAX_SUBSCRIBERS; i++){
+        Subscription *sub = &news_db->fanout.subs[i];
+        pthread_mutex_lock(&sub->mutex);
+        if(sub->active)
+            printf("Subscriber %d (%s): queued %d/%d, delivered %llu, dropped %llu%s\n",
+                   i, overflow_policy_name(sub->policy), sub->count, SUB_QUEUE_CAP,
+                   (unsigned long long)sub->delivered, (unsigned long long)sub->dropped,
+                   sub->connected ? "" : ", disconnected");
+        pthread_mutex_unlock(&sub->mutex);
     }
 }
 
@@ -429,7 +995,9 @@ void *news_agency_thread(void *arg){
         printf("\n=== News Agency Menu ===\n");
         printf("1. Add news\n");
         printf("2. Edit news\n");
-        printf("3. Back\n");
+        printf("3. Show stats\n");
+        printf("4. Publish-to-read latency\n");
+        printf("5. Back\n");
         printf("Choice: ");
 
         scanf("%d", &choice);
@@ -461,7 +1029,12 @@ void *news_agency_thread(void *arg){
             fgets(content, MAX_LINE, stdin);
             content[strcspn(content, "\n")]=0;
 
-            add_news(news_db, news_categories[category-1], title, content, 0);
+            if(add_news(news_db, news_categories[category-1], title, content, 0) < 0)
+                break;
+            if(wait_news_durable(news_db) == 0)
+                printf("[WRITER 0] News saved to disk (%s)\n", persist_backend_name(&news_db->persist));
+            else
+                printf("[WRITER 0] Warning: news could not be saved to disk\n");
             break;
 
         case 2:
@@ -473,6 +1046,14 @@ void *news_agency_thread(void *arg){
             break;
 
         case 3:
+            show_news_stats(news_db);
+            break;
+
+        case 4:
+            show_latency(news_db);
+            break;
+
+        case 5:
             return NULL;
 
         default:
@@ -540,17 +1121,19 @@ void *reader_thread(void *arg){
     return NULL;
 }
 
-// Reload news from file, ensuring no writer is active
+// Reload news from file, holding writers off until it is done
 void reload_news_db(NewsDB *news_db){
     printf("\n[READER] Refreshing...\n");
-
-    pthread_mutex_lock(&news_db->writer_lock);
-    if(news_db->is_writing){
-        printf("[READER] Cannot refresh - Writer active\n");
-        pthread_mutex_unlock(&news_db->writer_lock);
+    trace_reload();
+    if(news_db->follower){
+        printf("[READER] Followers stay current from the primary's log\n");
         return;
     }
-    pthread_mutex_unlock(&news_db->writer_lock);
+
+    // Nobody may publish between the flush and the re-read, or the file
+    // would miss what the ring has
+    admission_enter(&news_db->admission, PRIORITY_NORMAL);
+    persist_flush(&news_db->persist);
 
     pthread_mutex_lock(&news_db->lock);
     printf("[READER] Refreshing database...\n");
@@ -562,22 +1145,52 @@ void reload_news_db(NewsDB *news_db){
     if(!news_db->file){
         perror("Error reopening news file");
         pthread_mutex_unlock(&news_db->lock);
+        admission_leave(&news_db->admission);
         return;
     }
 
-    news_db->num_news = 0;
+    // Stories still on file keep their publish times
+    int kept_ids[MAX_NEWS];
+    uint64_t kept_ns[MAX_NEWS];
+    uint8_t kept_counted[MAX_NEWS];
+    int kept = 0;
+    for(int i = 0; i < news_db->num_news; i++){
+        int index = (news_db->start + i) % MAX_NEWS;
+        if(news_db->store->published_ns[index] == 0)
+            continue;
+        kept_ids[kept] = news_db->store->id[index];
+        kept_ns[kept] = news_db->store->published_ns[index];
+        kept_counted[kept++] = news_db->store->counted[index];
+    }
+
+    news_write_begin(news_db);
     load_news_from_file(news_db);
+    for(int k = 0; k < kept; k++){
+        int index = find_news_index(news_db, kept_ids[k]);
+        if(index >= 0){
+            news_db->store->published_ns[index] = kept_ns[k];
+            news_db->store->counted[index] = kept_counted[k];
+        }
+    }
+    seed_dedup(news_db);  // stories may have come back that dedup had forgotten
+    trend_init(&news_db->trend);  // stories may land in different slots
+    listing_invalidate_all(&news_db->listings);
+    replica_log_snapshot(news_db);
+    news_write_end(news_db);
 
     fclose(news_db->file);
     news_db->file= fopen(news_db->file_path, "a+");
 
     pthread_mutex_unlock(&news_db->lock);
+    admission_leave(&news_db->admission);
     printf("[READER] Refresh complete!\n");
 }
 
 // Run a demo with multiple readers and writers
 void run_demo(NewsDB *news_db){
     printf("\n=== Starting Enhanced Demo ===\n");
+    if(read_only(news_db, "[DEMO]"))
+        return;
     printf("Creating %d readers and %d writers...\n", NUM_DEMO_READERS, NUM_DEMO_WRITERS);
 
     // Create demo file with sample news
@@ -647,9 +1260,10 @@ void run_demo(NewsDB *news_db){
     printf("System will show warning at 18 items\n");
     printf("When buffer is full, oldest news will be removed automatically\n\n");
 
-    // Create reader and writer threads
-    pthread_t r_threads[NUM_DEMO_READERS];
-    pthread_t w_threads[NUM_DEMO_WRITERS];
+    // Readers and writers run as step tasks on the executor
+    Executor *executor = executor_default();
+    TaskGroup group;
+    task_group_init(&group);
     DemoArgs r_args[NUM_DEMO_READERS];
     DemoArgs w_args[NUM_DEMO_WRITERS];
 
@@ -657,38 +1271,37 @@ void run_demo(NewsDB *news_db){
     const int TIMEOUT_SECONDS=30;
 
     for(int i=0; i<NUM_DEMO_READERS; i++){
+        memset(&r_args[i], 0, sizeof(DemoArgs));
         r_args[i].news_db = news_db;
         r_args[i].thread_id= i + 1;
         r_args[i].is_writer = 0;
-        pthread_create(&r_threads[i], NULL, demo_reader_thread, &r_args[i]);
+        r_args[i].group = &group;
+        // Mix the overflow policies across readers
+        r_args[i].policy = (OverflowPolicy)(i % 3);
+        r_args[i].feed = fanout_subscribe(&news_db->fanout, r_args[i].policy);
+        if(r_args[i].feed < 0){
+            printf("[Reader %d] No subscriber slot available\n", i + 1);
+            continue;
+        }
+        executor_submit(executor, demo_reader_task, &r_args[i], &group);
     }
 
     for(int i=0; i < NUM_DEMO_WRITERS; i++){
+        memset(&w_args[i], 0, sizeof(DemoArgs));
         w_args[i].news_db= news_db;
         w_args[i].thread_id = i+1;
         w_args[i].is_writer= 1;
-        pthread_create(&w_threads[i], NULL, demo_writer_thread, &w_args[i]);
+        w_args[i].group = &group;
+        executor_submit(executor, demo_writer_task, &w_args[i], &group);
     }
 
-    for(int i=0; i<NUM_DEMO_READERS; i++){
-        while(time(NULL) - start_time < TIMEOUT_SECONDS){
-            if(demo_complete)
-                break;
-            sleep(1);
-        }
-        pthread_cancel(r_threads[i]);
-        pthread_join(r_threads[i], NULL);
-    }
+    while(time(NULL) - start_time < TIMEOUT_SECONDS && !demo_complete)
+        task_group_wait(&group, 1000);
 
-    for(int i=0; i<NUM_DEMO_WRITERS; i++){
-        while(time(NULL)-start_time<TIMEOUT_SECONDS){
-            if(demo_complete)
-                break;
-            sleep(1);
-        }
-        pthread_cancel(w_threads[i]);
-        pthread_join(w_threads[i], NULL);
-    }
+    // Tasks check the flag before every step, so this stops them cooperatively
+    demo_complete = 1;
+    task_group_wait(&group, -1);
+    task_group_destroy(&group);
 
     demo_complete = 0;
     // demo file dlete
@@ -696,17 +1309,53 @@ void run_demo(NewsDB *news_db){
     printf("\n=== Demonstration Complete ===\n");
 }
 
+// Subscriber-driven eviction: drop the oldest lowest-priority story only
+// when the buffer is full
+void remove_oldest_if_full(NewsDB *news_db){
+    if(read_only(news_db, "[SUBSCRIBER]"))
+        return;
+    pthread_mutex_lock(&news_db->lock);
+    trace_evict(1);
+    if(news_db->num_news == MAX_NEWS){
+        int index = eviction_victim(news_db);
+        char time_str[32];
+        struct tm *tm_info = localtime(&news_db->store->timestamp[index]);
+        strftime(time_str, sizeof(time_str), "%a %b %d %H:%M:%S %Y", tm_info);
+        printf("\n[SUBSCRIBER] Buffer full! Removing oldest news:\n");
+        printf("ID: %d\nCategory: %s\nTime: %s\nTitle: %s\nContent: %s\n",
+               news_db->store->id[index],
+               store_category(news_db->store, index),
+               time_str,
+               store_title(news_db->store, index),
+               store_content(news_db->store, index));
+
+        news_write_begin(news_db);
+        remove_story(news_db, index);
+        replica_log_snapshot(news_db);
+        news_write_end(news_db);
+        printf("[SUBSCRIBER] Oldest news removed. Publisher can now add news.\n");
+    }else{
+        printf("[SUBSCRIBER] Buffer is not full. No need to remove news.\n");
+    }
+    pthread_mutex_unlock(&news_db->lock);
+}
+
 // Subscriber thread for viewing and managing news
 void *subscriber_thread(void *arg){
     NewsDB *news_db = (NewsDB *)arg;
     int choice;
 
+    // Stories published while this session is open queue up here
+    int feed = fanout_subscribe(&news_db->fanout, OVERFLOW_DROP_OLDEST);
+
     while(1){
         printf("\n=== Subscriber Menu ===\n");
         printf("1. View by category\n");
         printf("2. Show all (with refresh)\n");
-        printf("3. Remove oldest news to free space for publisher\n");
-        printf("4. Back\n");
+        printf("3. Remove oldest low-priority news to free space for publisher\n");
+        printf("4. New stories since last check\n");
+        printf("5. Most read by category\n");
+        printf("6. Back\n");
         printf("Choice: ");
 
         scanf("%d", &choice);
@@ -733,31 +1382,43 @@ void *subscriber_thread(void *arg){
             break;
 
         case 3:
-            pthread_mutex_lock(&news_db->lock);
-            if(news_db->num_news == MAX_NEWS){
-                int index = news_db->start;
-                char time_str[32];
-                struct tm *tm_info = localtime(&news_db->news[index].timestamp);
-                strftime(time_str, sizeof(time_str), "%a %b %d %H:%M:%S %Y", tm_info);
-                printf("\n[SUBSCRIBER] Buffer full! Removing oldest news:\n");
-                printf("ID: %d\nCategory: %s\nTime: %s\nTitle: %s\nContent: %s\n",
-                       news_db->news[index].id,
-                       news_db->news[index].category,
-                       time_str,
-                       news_db->news[index].title,
-                       news_db->news[index].content);
-
-                news_db->start = (news_db->start + 1) % MAX_NEWS;
-                news_db->num_news--;
-                sem_post(&news_db->free_slots);
-                printf("[SUBSCRIBER] Oldest news removed. Publisher can now add news.\n");
-            }else{
-                printf("[SUBSCRIBER] Buffer is not full. No need to remove news.\n");
-            }
-            pthread_mutex_unlock(&news_db->lock);
+            remove_oldest_if_full(news_db);
             break;
 
         case 4:
+            if(feed < 0){
+                printf("[SUBSCRIBER] Too many subscribers, live feed unavailable\n");
+                break;
+            }
+            StoryRef ref;
+            int shown = 0, status;
+            while((status = fanout_next(&news_db->fanout, feed, &ref, 0)) > 0){
+                News news_item;
+                if(!read_story_ref(news_db, ref, &news_item))
+                    continue;
+                printf("\nID: %d\nCategory: %s\nTitle: %s\nContent: %s\n-------------------\n",
+                       news_item.id, news_item.category, news_item.title, news_item.content);
+                shown++;
+            }
+            if(!shown)
+                printf("[SUBSCRIBER] No new stories\n");
+            break;
+
+        case 5:
+            printf("\nCategories:\n");
+            for(int i=0; i<NUM_CATEGORIES; i++)
+                printf("%d. %s\n", i + 1, news_categories[i]);
+            printf("Category (1-%d): ", NUM_CATEGORIES);
+            scanf("%d", &category);
+            getchar();
+            if(category >= 1 && category <= NUM_CATEGORIES)
+                show_trending(news_db, news_categories[category - 1]);
+            else
+                printf("Invalid category\n");
+            break;
+
+        case 6:
+            fanout_unsubscribe(&news_db->fanout, feed);
             return NULL;
 
         default:
@@ -766,135 +1427,132 @@ void *subscriber_thread(void *arg){
     }
 }
 
-// Demo writer thread for adding news from demo file
-void *demo_writer_thread(void *arg){
+// Demo writer task: publishes one story from the demo file per step
+void demo_writer_task(void *arg){
     DemoArgs *args = (DemoArgs *)arg;
     NewsDB *news_db= args->news_db;
     int thread_id = args->thread_id;
-    int loops= 0;
     const int max_loops = 11;
 
-    FILE *demo_file= fopen(DEMO_FILE, "r");
-    if(!demo_file){
-        printf("[Writer %d] Error: Cannot open demo file '%s'\n", thread_id, DEMO_FILE);
-        return NULL;
-    }
-
     char line[MAX_LINE *2];
-    int start_line = (thread_id - 1)*max_loops;
-    for(int i=0; i<start_line; i++){
-        if(!fgets(line, sizeof(line), demo_file)){
-            rewind(demo_file);
-            break;
+    if(!args->demo_file){
+        args->demo_file= fopen(DEMO_FILE, "r");
+        if(!args->demo_file){
+            printf("[Writer %d] Error: Cannot open demo file '%s'\n", thread_id, DEMO_FILE);
+            return;
         }
-    }
 
-    while(loops< max_loops && !demo_complete){
-        if(!fgets(line, sizeof(line), demo_file)){
-            printf("[Writer %d] Reached end of demo file, restarting\n", thread_id);
-            rewind(demo_file);
-            continue;
-        }
-        char *title = strtok(line, "|");
-        char *content= strtok(NULL, "\n");
-        if(!title){
-            printf("[Writer %d] Warning: Malformed line in demo file, skipping\n", thread_id);
-            continue;
-        }
-        if(!content){
-            printf("[Writer %d] Warning: No content found, using default\n", thread_id);
-            content = "Demo content";
+        int start_line = (thread_id - 1)*max_loops;
+        for(int i=0; i<start_line; i++){
+            if(!fgets(line, sizeof(line), args->demo_file)){
+                rewind(args->demo_file);
+                break;
+            }
         }
+    }
 
-        char category[20];
-        strncpy(category, title, 19);
-        category[19] = '\0';
-        char *colon = strchr(category, ':');
-        if(colon){
-            *colon= '\0';
-            int valid_category= 0;
-            for(int i=0; i < NUM_CATEGORIES; i++){
-                if(strcmp(category, news_categories[i]) == 0){
-                    valid_category = 1;
-                    break;
-                }
-            }
-            if(!valid_category){
-                printf("[Writer %d] Warning: Invalid category '%s', using default\n", thread_id, category);
-                strncpy(category, news_categories[loops % NUM_CATEGORIES], 19);
+    if(args->loops >= max_loops || demo_complete){
+        fclose(args->demo_file);
+        args->demo_file = NULL;
+        printf("[Writer %d] Completed %d news items\n", thread_id, args->loops);
+        return;
+    }
+
+    if(!fgets(line, sizeof(line), args->demo_file)){
+        printf("[Writer %d] Reached end of demo file, restarting\n", thread_id);
+        rewind(args->demo_file);
+        executor_submit(executor_default(), demo_writer_task, args, args->group);
+        return;
+    }
+    char *title = strtok(line, "|");
+    char *content= strtok(NULL, "\n");
+    if(!title){
+        printf("[Writer %d] Warning: Malformed line in demo file, skipping\n", thread_id);
+        executor_submit(executor_default(), demo_writer_task, args, args->group);
+        return;
+    }
+    if(!content){
+        printf("[Writer %d] Warning: No content found, using default\n", thread_id);
+        content = "Demo content";
+    }
+
+    char category[20];
+    strncpy(category, title, 19);
+    category[19] = '\0';
+    char *colon = strchr(category, ':');
+    if(colon){
+        *colon= '\0';
+        int valid_category= 0;
+        for(int i=0; i < NUM_CATEGORIES; i++){
+            if(strcmp(category, news_categories[i]) == 0){
+                valid_category = 1;
+                break;
             }
-            title= title + (colon - category) + 2;
-            while(*title == ' ') title++;
-        }else{
-            printf("[Writer %d] Warning: No category in title, using default\n", thread_id);
-            strncpy(category, news_categories[loops % NUM_CATEGORIES], 19);
         }
-        sem_wait(&news_db->free_slots);
-        add_news(news_db, category, title, content, thread_id);
-        loops++;
-
-        if(loops>= max_loops){
-            demo_complete= 1;
+        if(!valid_category){
+            printf("[Writer %d] Warning: Invalid category '%s', using default\n", thread_id, category);
+            strncpy(category, news_categories[args->loops % NUM_CATEGORIES], 19);
         }
+        title= title + (colon - category) + 2;
+        while(*title == ' ') title++;
+    }else{
+        printf("[Writer %d] Warning: No category in title, using default\n", thread_id);
+        strncpy(category, news_categories[args->loops % NUM_CATEGORIES], 19);
+    }
+    add_news(news_db, category, title, content, thread_id);
+    args->loops++;
 
-        sleep(2); //writing delay - to make it real  ... DRAMAAA
+    if(args->loops>= max_loops){
+        demo_complete= 1;
     }
 
-    fclose(demo_file);
-    printf("[Writer %d] Completed %d news items\n", thread_id, loops);
-    return NULL;
+    //writing delay - to make it real  ... DRAMAAA
+    executor_submit_after(executor_default(), demo_writer_task, args, args->group, 2000);
 }
 
-// Demo reader thread for reading news
-void *demo_reader_thread(void *arg){
+// Demo reader task: reads one story per step from its own fan-out queue
+void demo_reader_task(void *arg){
     DemoArgs *args= (DemoArgs *)arg;
     NewsDB *news_db = args->news_db;
     int thread_id= args->thread_id;
-    int loops = 0;
-
-    while(loops < 10 && !demo_complete){
-        sem_wait(&news_db->used_slots);
-
-        pthread_mutex_lock(&news_db->reader_lock);
-        news_db->num_readers++;
-        if(news_db->num_readers == 1)
-            pthread_mutex_lock(&news_db->rw_lock);
-        pthread_mutex_unlock(&news_db->reader_lock);
-
-        pthread_mutex_lock(&news_db->lock);
-
-        if(news_db->num_news > 0){
-            int index = (news_db->start + (loops % news_db->num_news)) % MAX_NEWS;
-
-            char time_str[32];
-            struct tm *tm_info= localtime(&news_db->news[index].timestamp);
-            strftime(time_str, sizeof(time_str), "%a %b %d %H:%M:%S %Y", tm_info);
-
-            printf("\n=== Reader %d Reading ===\n", thread_id);
-            printf("ID: %d\n", news_db->news[index].id);
-            printf("Category: %s\n", news_db->news[index].category);
-            printf("Title: %s\n", news_db->news[index].title);
-            printf("Content: %s\n", time_str);
-            printf("Time: %s\n", time_str);
-            printf("Total items in buffer: %d\n", news_db->num_news);
-            printf("-------------------\n");
-        }else{
-            printf("\n=== Reader %d Reading ===\n", thread_id);
-            printf("Buffer empty\n");
-        }
-
-        pthread_mutex_unlock(&news_db->lock);
 
-        pthread_mutex_lock(&news_db->reader_lock);
-        news_db->num_readers--;
-        if(news_db->num_readers == 0)
-            pthread_mutex_unlock(&news_db->rw_lock);
-        pthread_mutex_unlock(&news_db->reader_lock);
+    if(args->loops >= 10 || demo_complete){
+        fanout_unsubscribe(&news_db->fanout, args->feed);
+        return;
+    }
 
-        sem_post(&news_db->free_slots);
+    StoryRef ref;
+    int status = fanout_next(&news_db->fanout, args->feed, &ref, 0);
+    if(status < 0){
+        printf("\n=== Reader %d disconnected (fell behind, policy %s) ===\n", thread_id, overflow_policy_name(args->policy));
+        fanout_unsubscribe(&news_db->fanout, args->feed);
+        return;
+    }
+    if(status == 0){
+        // Nothing new yet, look again shortly
+        executor_submit_after(executor_default(), demo_reader_task, args, args->group, 200);
+        return;
+    }
 
-        loops++;
-        sleep(1);
+    News news_item;
+    printf("\n=== Reader %d Reading ===\n", thread_id);
+    if(read_story_ref(news_db, ref, &news_item)){
+        char time_str[32];
+        struct tm tm_info;
+        localtime_r(&news_item.timestamp, &tm_info);
+        strftime(time_str, sizeof(time_str), "%a %b %d %H:%M:%S %Y", &tm_info);
+
+        printf("ID: %d\n", news_item.id);
+        printf("Category: %s\n", news_item.category);
+        printf("Title: %s\n", news_item.title);
+        printf("Content: %s\n", news_item.content);
+        printf("Time: %s\n", time_str);
+        printf("Total items in buffer: %d\n", news_db->num_news);
+        printf("-------------------\n");
+    }else{
+        printf("News %d already removed from buffer\n", ref.id);
     }
-    return NULL;
+
+    args->loops++;
+    executor_submit_after(executor_default(), demo_reader_task, args, args->group, 1000);
 }
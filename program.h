@@ -10,20 +10,177 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <semaphore.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 #define MAX_NEWS 20
 #define MAX_LINE 256
 #define NEWS_FILE "news_database.txt"
 #define CATEGORY_FILE "categories.txt"
+#define CHECKPOINT_FILE "news_database.ckpt"
+#define CHECKPOINT_EVERY 64
 #define NUM_READERS 5
 #define DEMO_FILE "demo_news.txt"
 #define NUM_DEMO_READERS 5
 #define NUM_DEMO_WRITERS 2
 #define WARN_THRESHOLD 18
 #define NUM_CATEGORIES 6
+#define DEDUP_TABLE_SIZE 4096
+#define DEDUP_MAX_PROBE 16
+#define DEDUP_WINDOW_SECS 600
+#define SHM_MAGIC 0x4e455753u
+#define SHM_PAGE 65536  // largest common page size
+#define MAX_SUBSCRIBERS 16
+#define SUB_QUEUE_CAP 8
+#define CATEGORY_OTHER 0xff
+#define STORY_TEXT_SIZE (20 + 2 * MAX_LINE)
+#define TREND_BUCKETS 16
+#define TREND_BUCKET_SECS 60
+#define TREND_WINDOW_MINUTES 15
+#define TREND_TOP_K 5
+#define MAX_PUBLISHERS 64
+#define PUBLISH_RATE 0  // stories/s per publisher by default, 0 for no limit
+#define PUBLISH_BURST_SECS 2
+#define IMPORT_BATCH 64
+#define ADMISSION_MAX_BYPASS 8
+#define LISTING_KEYS (NUM_CATEGORIES + 1)
+#define LISTING_SIZE (MAX_NEWS * (STORY_TEXT_SIZE + 128) + 64)
+#define LATENCY_SUB_BITS 4
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+#define REPLICA_BACKLOG 256
+#define REPLICA_MAX_FOLLOWERS 8
+#define REPLICA_HEARTBEAT_MS 100
+#define REPLICA_RETRY_MS 200
+#define REPLICA_BATCH 64
 
 extern const char* news_categories[];
 
+typedef void (*TaskFn)(void* arg);
+
+// Tracks a set of tasks so a caller can wait for all of them
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    int pending;
+} TaskGroup;
+
+typedef struct {
+    TaskFn fn;
+    void* arg;
+    TaskGroup* group;
+    uint64_t due_ns;
+} Task;
+
+// Per-worker task deque
+typedef struct {
+    pthread_mutex_t lock;
+    Task* items;
+    int head;
+    int count;
+    int cap;
+} WorkDeque;
+
+// Fixed-size work-stealing thread pool
+typedef struct {
+    int num_workers;
+    int started;
+    pthread_t* threads;
+    WorkDeque* deques;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int ready;
+    int stop;
+    unsigned next_queue;
+    Task* timers;
+    int num_timers;
+    int cap_timers;
+} Executor;
+
+typedef enum {
+    PERSIST_APPEND,
+    PERSIST_REWRITE
+} PersistOp;
+
+typedef enum {
+    PERSIST_BACKEND_PWRITEV,
+    PERSIST_BACKEND_IO_URING
+} PersistBackend;
+
+typedef struct PersistJob {
+    PersistOp op;
+    uint64_t ticket;
+    char* buf;
+    size_t len;
+    struct PersistJob* next;
+} PersistJob;
+
+// Write-behind queue for the news file, drained by an executor task
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t done_cond;
+    PersistJob* head;
+    PersistJob* tail;
+    uint64_t next_ticket;
+    uint64_t done_ticket;
+    uint64_t failed_from;  // lowest failed ticket no rewrite has covered since (0 = none)
+    uint64_t failed_last;  // highest failed ticket
+    int draining;
+    PersistBackend backend;
+    void* uring;
+    Executor* executor;
+    int fd;
+    int dir_fd;
+    off_t offset;
+    char path[256];
+    char temp_path[260];
+} PersistQueue;
+
+typedef enum {
+    OVERFLOW_BLOCK,
+    OVERFLOW_DROP_OLDEST,
+    OVERFLOW_DISCONNECT
+} OverflowPolicy;
+
+// Reference to a story in the ring; stale once the slot holds another ID
+typedef struct {
+    int id;
+    int slot;
+} StoryRef;
+
+// One subscriber's bounded delivery queue
+typedef struct {
+    int active;
+    int connected;
+    OverflowPolicy policy;
+    StoryRef queue[SUB_QUEUE_CAP];
+    int head;
+    int count;
+    uint64_t delivered;
+    uint64_t dropped;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} Subscription;
+
+typedef struct {
+    Subscription subs[MAX_SUBSCRIBERS];
+    pthread_mutex_t registry_lock;
+} FanOut;
+
+// Lock-free hash table of recently published stories, for ingest dedup.
+// The lock and condition only serve publishers waiting on someone else's
+// pending claim.
+typedef struct {
+    uint64_t entries[DEDUP_TABLE_SIZE];
+    uint64_t seen[DEDUP_TABLE_SIZE];
+    int window_secs;
+    uint64_t lookups;
+    uint64_t hits;
+    int waiters;
+    pthread_mutex_t wait_lock;
+    pthread_cond_t resolved;
+} DedupTable;
+
 typedef struct {
     int id;
     char category[20];
@@ -32,24 +189,267 @@ typedef struct {
     time_t timestamp;
 } News;
 
+typedef void (*NewsSink)(const News* news_item, void* arg);
+
+// One story handed to add_news_batch
+typedef struct {
+    const char* category;
+    const char* title;
+    const char* content;
+} NewsDraft;
+
+// Priority class of a category; lower values are admitted first and evicted last
+typedef enum {
+    PRIORITY_URGENT,
+    PRIORITY_NORMAL,
+    PRIORITY_BULK,
+    NUM_PRIORITIES
+} NewsPriority;
+
+// Writer admission: one writer in the store at a time, taken from the
+// highest-priority lane with anyone waiting, FIFO within a lane. A lane
+// passed over ADMISSION_MAX_BYPASS times in a row gets the next turn.
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t turn[NUM_PRIORITIES];
+    int busy;
+    int lanes;  // 0 puts everyone in one FIFO lane (for comparison)
+    int favored;  // lane owed the next turn, -1 for none
+    uint32_t bypassed[NUM_PRIORITIES];
+    uint32_t next_ticket[NUM_PRIORITIES];
+    uint32_t serving[NUM_PRIORITIES];
+    uint64_t admitted[NUM_PRIORITIES];
+    uint64_t queued[NUM_PRIORITIES];
+    uint64_t wait_ns[NUM_PRIORITIES];
+    uint64_t max_wait_ns[NUM_PRIORITIES];
+} AdmissionQueue;
+
 typedef struct {
-    News news[MAX_NEWS];
+    double tokens;
+    uint64_t last_ns;
+} PublisherBucket;
+
+// Per-publisher token buckets; a publisher over its rate waits for a token
+typedef struct {
+    pthread_mutex_t lock;
+    double rate;  // stories per second, 0 for no limit
+    double burst;
+    PublisherBucket buckets[MAX_PUBLISHERS];
+    uint64_t throttled;
+    uint64_t throttled_ns;
+} RateLimiter;
+
+// Background checkpoint writer; a new checkpoint starts every
+// CHECKPOINT_EVERY publishes and on close
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t done_cond;
+    int running;
+    int since;
+    uint64_t written;
+    uint64_t last_offset;
+    double last_ms;
+    char path[256];
+} CheckpointState;
+
+// The ring's stories, split so scans over ids, categories and times touch
+// only small dense arrays; the text sits in a separate heap, a fixed
+// STORY_TEXT_SIZE share per slot so the store works in shared memory too
+typedef struct {
+    int id[MAX_NEWS];
+    uint8_t category[MAX_NEWS];
+    time_t timestamp[MAX_NEWS];
+    uint32_t category_off[MAX_NEWS];
+    uint32_t title_off[MAX_NEWS];
+    uint32_t content_off[MAX_NEWS];
+    uint64_t published_ns[MAX_NEWS];  // CLOCK_MONOTONIC at add_news, 0 if loaded from disk
+    uint8_t counted[MAX_NEWS];        // a read of the story has been timed already
+    char text[MAX_NEWS * STORY_TEXT_SIZE];
+} NewsStore;
+
+// Cost of the most recent load_news_from_file
+typedef struct {
+    uint64_t bytes;
+    uint64_t stories;
+    int skipped;
+    int chunks;
+    double seconds;
+} LoadStats;
+
+// The newest MAX_NEWS stories of a parsed buffer (story i at
+// recent[i % MAX_NEWS]), ready to go into a ring
+typedef struct {
+    News recent[MAX_NEWS];
+    size_t count;
+    LoadStats stats;
+} ParsedNews;
+
+// Read counts per ring slot in TREND_BUCKET_SECS buckets, guarded by the
+// store lock. Each counter packs its bucket's epoch (high 32 bits) with the
+// count, so buckets left over from an earlier lap read as zero.
+typedef struct {
+    uint64_t counts[MAX_NEWS][TREND_BUCKETS];
+} TrendTable;
+
+typedef struct {
+    int id;
+    int slot;
+    uint64_t reads;
+    char title[MAX_LINE];
+} TrendEntry;
+
+// Log-linear histogram of nanosecond latencies, HDR style: each power of
+// two split into 2^LATENCY_SUB_BITS buckets, so percentiles are within
+// about 6% at any scale. Counters are updated with relaxed atomics.
+typedef struct {
+    uint64_t counts[LATENCY_BUCKETS];
+    uint64_t total;
+    uint64_t max_ns;
+} LatencyHistogram;
+
+// Publish-to-read latency per known category, other categories last
+typedef struct {
+    LatencyHistogram by_category[NUM_CATEGORIES + 1];
+} LatencyTable;
+
+// A rendered listing and the ring slots it shows (for read counting)
+typedef struct {
+    uint32_t version;
+    int count;
+    uint8_t slots[MAX_NEWS];
+    size_t len;
+    char text[LISTING_SIZE];
+} Listing;
+
+// Rendered listings per known category, plus all news in the last entry.
+// A listing is current while its version matches; writes bump the
+// versions of the categories they touch (and of all news).
+typedef struct {
+    uint32_t version[LISTING_KEYS];
+    Listing listings[LISTING_KEYS];
+    uint64_t hits;
+    uint64_t misses;
+} ListingCache;
+
+typedef enum {
+    REPLICA_APPEND,    // lines added to the end of the log
+    REPLICA_REWRITE,   // the whole log replaced (evictions, edits, snapshots)
+    REPLICA_HEARTBEAT  // nothing new; carries the primary's position
+} ReplicaOp;
+
+// One record of the primary's log, kept for followers to catch up from
+typedef struct {
+    uint64_t lsn;
+    uint64_t logged_ns;
+    ReplicaOp op;
+    char* buf;
+    size_t len;
+} ReplicaRecord;
+
+// A follower connected to this primary
+typedef struct {
+    int fd;
+    int active;
+    int started;
+    uint64_t sent_lsn;
+    uint64_t snapshots;
+    pthread_t thread;
+} ReplicaLink;
+
+// Primary side of log shipping: the last REPLICA_BACKLOG log records
+// (record lsn sits at lsn % REPLICA_BACKLOG) and the followers they
+// stream to over a Unix socket
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t more;
+    char path[108];
+    int listen_fd;
+    int stopping;
+    uint64_t epoch;
+    uint64_t lsn;
+    ReplicaRecord backlog[REPLICA_BACKLOG];
+    ReplicaLink links[REPLICA_MAX_FOLLOWERS];
+    pthread_t acceptor;
+} ReplicaPrimary;
+
+// Follower side: where it is in the primary's log and how far behind
+typedef struct {
+    pthread_mutex_t lock;
+    char path[108];
+    int fd;
+    int connected;
+    int stopping;
+    uint64_t primary_lsn;  // newest record the primary had logged, as of the last frame
+    uint64_t max_behind;   // most records the primary was ahead by
+    uint64_t applied;
+    uint64_t superseded;   // received behind a later rewrite, so not applied
+    uint64_t snapshots;
+    uint64_t connects;
+    uint64_t last_lag_ns;
+    LatencyHistogram lag;  // logged on the primary to applied here
+    pthread_t thread;
+} ReplicaFollower;
+
+// What subscriber processes see of a publisher's ring: the store and its
+// bounds, under their own seqlock
+typedef struct {
+    unsigned seq;
+    int start;
+    int num_news;
+    NewsStore store;
+} SharedRing;
+
+// Process-local: a shared-memory publisher keeps this in its own memory
+// and only the ring lives in the segment
+typedef struct {
+    NewsStore* store;  // local_store, or the shared ring's
+    NewsStore local_store;
+    SharedRing* shared;
     int num_news;
     int start;
     int end;
     pthread_mutex_t lock;
     pthread_mutex_t rw_lock;
     pthread_mutex_t reader_lock;
-    pthread_mutex_t writer_lock;
-    sem_t free_slots;
     sem_t used_slots;
+    AdmissionQueue admission;
+    RateLimiter limits;
+    uint64_t evicted[NUM_PRIORITIES];
+    ListingCache listings;
+    LatencyTable latency;
     int num_readers;
     int is_writing;
     FILE* file;
     FILE* cat_file;
     char file_path[256];
+    PersistQueue persist;
+    uint64_t last_ticket;
+    DedupTable dedup;
+    FanOut fanout;
+    unsigned seq;
+    int next_id;
+    LoadStats last_load;
+    TrendTable trend;
+    uint64_t log_bytes;
+    uint64_t log_tail_len;
+    uint64_t log_tail_hash;
+    CheckpointState checkpoint;
+    ReplicaPrimary* primary;
+    ReplicaFollower* follower;
+    uint64_t replica_epoch;  // the primary log this database follows, and the
+    uint64_t replica_lsn;    // last record of it applied (followers)
 } NewsDB;
 
+// A named shared-memory segment. Subscribers map the header read-write
+// (they probe the owner lock) and the ring, a page further on, read-only.
+typedef struct {
+    uint32_t magic;
+    uint32_t size;
+    pid_t owner_pid;              // last publisher, 0 after a clean close
+    pthread_mutex_t owner_lock;   // robust, held by the publishing process
+    SharedRing ring __attribute__((aligned(SHM_PAGE)));
+} SharedNewsSegment;
+
 typedef struct {
     NewsDB* news_db;
     int thread_id;
@@ -59,23 +459,168 @@ typedef struct {
     NewsDB* news_db;
     int thread_id;
     int is_writer;
+    TaskGroup* group;
+    int loops;
+    int feed;
+    OverflowPolicy policy;
+    FILE* demo_file;
 } DemoArgs;
 
 void init_news_db(NewsDB* news_db);
+void init_news_db_shared(NewsDB* news_db, SharedRing* ring);
+void news_write_begin(NewsDB* news_db);
+void news_write_end(NewsDB* news_db);
 void close_news_db(NewsDB* news_db);
-void add_news(NewsDB* news_db, const char* category, const char* title, const char* content, int writer_id);
+FILE* news_file(NewsDB* news_db);
+int add_news(NewsDB* news_db, const char* category, const char* title, const char* content, int writer_id);
+int add_news_batch(NewsDB* news_db, const NewsDraft* drafts, int count, int* ids, int writer_id);
+int import_news(NewsDB* news_db, const char* path);
 void edit_news(NewsDB* news_db, int news_id);
+int apply_news_edit(NewsDB* news_db, int news_id, const char* new_title, const char* new_content, int category);
+int get_news_by_id(NewsDB* news_db, int news_id, News* out);
+void remove_oldest_if_full(NewsDB* news_db);
 void show_news_by_category(NewsDB* news_db, const char* category);
 void show_all_news(NewsDB* news_db);
-void save_news_to_file(NewsDB* news_db, News* news_item);
+uint64_t save_news_to_file(NewsDB* news_db, News* news_item);
+uint64_t save_news_snapshot(NewsDB* news_db);
+char* format_news_snapshot(NewsDB* news_db, size_t* len);
+int wait_news_durable(NewsDB* news_db);
 void load_news_from_file(NewsDB* news_db);
+void load_news_tail(NewsDB* news_db, uint64_t offset);
 void* news_agency_thread(void* arg);
 void* reader_thread(void* arg);
 void reload_news_db(NewsDB* news_db);
 void run_demo(NewsDB* news_db);
 void* subscriber_thread(void* arg);
-void* demo_writer_thread(void* arg);
-void* demo_reader_thread(void* arg);
-void remove_oldest_news(NewsDB* news_db);
+void demo_writer_task(void* arg);
+void demo_reader_task(void* arg);
+void evict_news(NewsDB* news_db);
+void show_news_stats(NewsDB* news_db);
+int read_story_ref(NewsDB* news_db, StoryRef ref, News* out);
+
+uint8_t news_category_index(const char* name);
+NewsPriority news_priority(uint8_t category);
+const char* news_priority_name(NewsPriority priority);
+void admission_init(AdmissionQueue* adm, int process_shared);
+void admission_destroy(AdmissionQueue* adm);
+void admission_enter(AdmissionQueue* adm, NewsPriority priority);
+void admission_leave(AdmissionQueue* adm);
+void ratelimit_init(RateLimiter* rl, int process_shared);
+void ratelimit_set(RateLimiter* rl, double rate, double burst);
+void ratelimit_acquire(RateLimiter* rl, int publisher, int count);
+void store_put(NewsStore* store, int slot, const News* news_item);
+void store_get(const NewsStore* store, int slot, News* out);
+void store_move(NewsStore* store, int dst, int src);
+const char* store_category(const NewsStore* store, int slot);
+const char* store_title(const NewsStore* store, int slot);
+const char* store_content(const NewsStore* store, int slot);
+size_t scan_category(const uint8_t* categories, size_t n, uint8_t cat, uint8_t* match);
+long scan_find_id(const int* ids, size_t n, size_t from, int id);
+
+void listing_init(ListingCache* cache);
+void listing_invalidate(ListingCache* cache, uint8_t category);
+void listing_invalidate_all(ListingCache* cache);
+void listing_show(NewsDB* news_db, const char* category);
+double listing_hit_rate(const ListingCache* cache);
+
+uint64_t latency_now_ns(void);
+void latency_init(LatencyTable* table);
+void latency_record(LatencyHistogram* hist, uint64_t ns);
+void latency_record_read(NewsDB* news_db, int slot, uint64_t now_ns);
+uint64_t latency_percentile(const LatencyHistogram* hist, double p);
+void latency_merge(LatencyHistogram* into, const LatencyHistogram* from);
+void show_latency(NewsDB* news_db);
+
+void trend_init(TrendTable* trend);
+void trend_reset_slot(TrendTable* trend, int slot);
+void trend_move_slot(TrendTable* trend, int dst, int src);
+void trend_remap(TrendTable* trend, const int* from);
+uint32_t trend_epoch(void);
+void trend_record(TrendTable* trend, int slot, uint32_t epoch);
+uint64_t trend_reads(const TrendTable* trend, int slot, int window_buckets);
+int trend_top(NewsDB* news_db, const char* category, int window_minutes, TrendEntry* top, int k);
+void show_trending(NewsDB* news_db, const char* category);
+
+int parse_news_line_legacy(const char* line, News* out);
+size_t parse_news_text(const char* buf, size_t len, NewsSink sink, void* arg, int* skipped);
+int load_news_buffer(NewsDB* news_db, const char* buf, size_t len);
+void parse_news_buffer(const char* buf, size_t len, ParsedNews* out);
+void load_parsed_news(NewsDB* news_db, const ParsedNews* parsed);
+void load_news_item(NewsDB* news_db, const News* news_item);
+const char* loader_scanner_name(void);
+
+void checkpoint_note_tail(NewsDB* news_db, const char* buf, size_t len);
+void checkpoint_init(CheckpointState* cp, const char* path);
+int checkpoint_write(NewsDB* news_db);
+void checkpoint_start(NewsDB* news_db);
+void checkpoint_close(NewsDB* news_db);
+int checkpoint_restore(NewsDB* news_db);
+
+int replica_primary_start(NewsDB* news_db, const char* path);
+int replica_follow(NewsDB* news_db, const char* path);
+void replica_log(NewsDB* news_db, ReplicaOp op, const char* buf, size_t len);
+void replica_close(NewsDB* news_db);
+void replica_show_stats(NewsDB* news_db);
+
+int persist_init(PersistQueue* q, const char* path, Executor* executor);
+void persist_close(PersistQueue* q);
+uint64_t persist_submit(PersistQueue* q, PersistOp op, char* buf, size_t len);
+int persist_wait(PersistQueue* q, uint64_t ticket);
+int persist_flush(PersistQueue* q);
+const char* persist_backend_name(const PersistQueue* q);
+
+uint64_t dedup_hash(const char* category, const char* title, const char* content);
+void dedup_init(DedupTable* table, int window_secs, int process_shared);
+void dedup_destroy(DedupTable* table);
+void dedup_set_window(DedupTable* table, int window_secs);
+int dedup_claim(DedupTable* table, uint64_t hash, uint32_t now, int* slot);
+void dedup_wait(DedupTable* table, int slot, uint64_t hash);
+void dedup_publish(DedupTable* table, int slot, uint64_t hash, int id, uint32_t now);
+void dedup_abandon(DedupTable* table, int slot);
+void dedup_drop_pending(DedupTable* table);
+int dedup_get_entry(DedupTable* table, int index, uint64_t* entry, uint64_t* seen);
+void dedup_set_entry(DedupTable* table, int index, uint64_t entry, uint64_t seen);
+void dedup_seed(DedupTable* table, const News* news_item);
+double dedup_hit_rate(const DedupTable* table);
+
+Executor* executor_create(int num_workers);
+void executor_shutdown(Executor* ex);
+Executor* executor_default(void);
+void executor_submit(Executor* ex, TaskFn fn, void* arg, TaskGroup* group);
+void executor_submit_after(Executor* ex, TaskFn fn, void* arg, TaskGroup* group, int delay_ms);
+int executor_stopping(Executor* ex);
+int executor_help(Executor* ex);
+void executor_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex);
+void executor_sleep(uint64_t ns);
+void task_group_init(TaskGroup* group);
+void task_group_destroy(TaskGroup* group);
+int task_group_wait(TaskGroup* group, int timeout_ms);
+
+void fanout_init(FanOut* fan, int process_shared);
+void fanout_destroy(FanOut* fan);
+int fanout_subscribe(FanOut* fan, OverflowPolicy policy);
+void fanout_unsubscribe(FanOut* fan, int handle);
+void fanout_publish(FanOut* fan, StoryRef ref);
+int fanout_next(FanOut* fan, int handle, StoryRef* ref, int timeout_ms);
+const char* overflow_policy_name(OverflowPolicy policy);
+
+int trace_start(const char* path, NewsDB* news_db);
+void trace_stop(void);
+void trace_publish(int id, const char* category, const char* title, const char* content, int writer_id);
+void trace_edit(int id, const char* title, const char* content, int category);
+void trace_read_category(const char* category);
+void trace_read_all(void);
+void trace_read_story(StoryRef ref);
+void trace_reload(void);
+void trace_evict(int manual);
+int replay_trace(const char* path, int fast, const char* report_path, const char* baseline_path);
+
+int open_shared_news_db(NewsDB* news_db, const char* name);
+void close_shared_news_db(NewsDB* news_db);
+SharedNewsSegment* attach_shared_news(const char* name);
+void detach_shared_news(SharedNewsSegment* seg);
+int publisher_alive(SharedNewsSegment* seg);
+int read_shared_news(SharedNewsSegment* seg, void (*visit)(const NewsStore* store, int slot, void* arg), void (*restart)(void* arg), void* arg);
+void* shared_subscriber_thread(void* arg);
 
 #endif
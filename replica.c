@@ -0,0 +1,795 @@
+#include "program.h"
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Wire format: a follower opens with a ReplicaHello saying how far into
+// which primary log it is; the primary answers with frames, each a
+// ReplicaFrame header followed by len bytes of the news file
+#define REPLICA_MAGIC 0x4e52504cu
+#define REPLICA_MAX_RECORD (64u << 20)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t epoch;  // primary log the follower applied records of (0: none)
+    uint64_t lsn;    // last record of it applied
+} ReplicaHello;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t op;
+    uint16_t snapshot;   // a REWRITE of the primary's buffer, not a logged one
+    uint64_t epoch;
+    uint64_t lsn;
+    uint64_t head_lsn;   // newest record on the primary when this was sent
+    uint64_t logged_ns;  // when the primary logged it (CLOCK_MONOTONIC)
+    uint64_t len;
+} ReplicaFrame;
+
+typedef struct {
+    NewsDB *news_db;
+    ReplicaLink *link;
+    int index;
+} SenderArgs;
+
+// Bytes received from the primary but not yet applied
+typedef struct {
+    char *data;
+    size_t cap;
+    size_t start;
+    size_t end;
+} RecvBuffer;
+
+// Stories of one record being applied on a follower
+typedef struct {
+    NewsDB *news_db;
+    uint64_t published_ns;
+    StoryRef refs[MAX_NEWS];  // the newest MAX_NEWS of them
+    int count;
+    int skipped;
+} ApplyState;
+
+static void sleep_ms(int ms){
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+    while(nanosleep(&ts, &ts) < 0 && errno == EINTR)
+        ;
+}
+
+static int write_full(int fd, const void *data, size_t len){
+    const char *p = (const char *)data;
+    while(len > 0){
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int read_full(int fd, void *data, size_t len){
+    char *p = (char *)data;
+    while(len > 0){
+        ssize_t n = recv(fd, p, len, 0);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Add a frame and its record to the batch being built in *out
+static int append_frame(char **out, size_t *cap, size_t *len, const ReplicaFrame *frame, const char *buf){
+    size_t need = *len + sizeof(*frame) + frame->len;
+    if(need > *cap){
+        size_t grown = *cap ? *cap : 65536;
+        while(grown < need)
+            grown *= 2;
+        char *p = realloc(*out, grown);
+        if(!p)
+            return -1;
+        *out = p;
+        *cap = grown;
+    }
+    memcpy(*out + *len, frame, sizeof(*frame));
+    if(frame->len > 0)
+        memcpy(*out + *len + sizeof(*frame), buf, frame->len);
+    *len = need;
+    return 0;
+}
+
+static int unix_socket(const char *path, struct sockaddr_un *addr){
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    snprintf(addr->sun_path, sizeof(addr->sun_path), "%s", path);
+    return socket(AF_UNIX, SOCK_STREAM, 0);
+}
+
+// Hand a copy of a log record to the followers. Called with the store lock
+// held, right where the record is queued for the file, so records are
+// numbered in log order.
+void replica_log(NewsDB *news_db, ReplicaOp op, const char *buf, size_t len){
+    ReplicaPrimary *rp = news_db->primary;
+    if(!rp)
+        return;
+    // Without a copy (or with a NULL buf) the record is a gap; followers
+    // reaching it resync from a snapshot
+    char *copy = buf ? malloc(len > 0 ? len : 1) : NULL;
+    if(copy)
+        memcpy(copy, buf, len);
+
+    pthread_mutex_lock(&rp->lock);
+    ReplicaRecord *rec = &rp->backlog[++rp->lsn % REPLICA_BACKLOG];
+    free(rec->buf);
+    rec->lsn = rp->lsn;
+    rec->logged_ns = latency_now_ns();
+    rec->op = op;
+    rec->buf = copy;
+    rec->len = len;
+    pthread_cond_broadcast(&rp->more);
+    pthread_mutex_unlock(&rp->lock);
+}
+
+// The primary's buffer as of its newest record, for a follower the backlog
+// can't bring up to date
+static char *take_snapshot(NewsDB *news_db, size_t *len, uint64_t *lsn){
+    ReplicaPrimary *rp = news_db->primary;
+    pthread_mutex_lock(&news_db->lock);
+    char *buf = format_news_snapshot(news_db, len);
+    pthread_mutex_lock(&rp->lock);
+    *lsn = rp->lsn;
+    pthread_mutex_unlock(&rp->lock);
+    pthread_mutex_unlock(&news_db->lock);
+    return buf;
+}
+
+// Wait for the record after next - 1, up to a heartbeat (caller holds rp->lock)
+static void wait_for_record(ReplicaPrimary *rp, uint64_t next){
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += REPLICA_HEARTBEAT_MS * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    while(!rp->stopping && rp->lsn < next)
+        if(pthread_cond_timedwait(&rp->more, &rp->lock, &deadline) == ETIMEDOUT)
+            break;
+}
+
+// The acceptor, the senders and a follower's receive loop each get a thread
+// of their own rather than an executor task: they sit in blocking accept,
+// send and recv calls for as long as replication runs, and each would take
+// a pool worker out for good (REPLICA_MAX_FOLLOWERS senders alone can
+// outnumber the workers and stall every task queued behind them).
+
+// Stream the log to one follower: from the record after the one it has if
+// the backlog still reaches back that far, else from a fresh snapshot
+static void *sender_thread(void *arg){
+    SenderArgs *args = (SenderArgs *)arg;
+    NewsDB *news_db = args->news_db;
+    ReplicaPrimary *rp = news_db->primary;
+    ReplicaLink *link = args->link;
+    int index = args->index;
+    free(args);
+
+    ReplicaHello hello;
+    uint64_t next = 0;  // 0 until the follower has a starting point
+    int ok = read_full(link->fd, &hello, sizeof(hello)) == 0 && hello.magic == REPLICA_MAGIC;
+    if(ok){
+        pthread_mutex_lock(&rp->lock);
+        if(hello.epoch == rp->epoch && hello.lsn <= rp->lsn && rp->lsn - hello.lsn < REPLICA_BACKLOG)
+            next = hello.lsn + 1;
+        pthread_mutex_unlock(&rp->lock);
+        printf("[PRIMARY] Follower %d connected at record %llu, %s\n", index, (unsigned long long)hello.lsn,
+               next ? "resuming from the backlog" : "sending a snapshot");
+    }
+
+    char *out = NULL;
+    size_t cap = 0;
+    while(ok){
+        ReplicaFrame frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.magic = REPLICA_MAGIC;
+        frame.epoch = rp->epoch;
+        size_t len = 0;
+
+        if(next == 0){
+            size_t snap_len;
+            char *snap = take_snapshot(news_db, &snap_len, &frame.lsn);
+            if(!snap)
+                break;
+            frame.op = REPLICA_REWRITE;
+            frame.snapshot = 1;
+            frame.head_lsn = frame.lsn;
+            frame.logged_ns = latency_now_ns();
+            frame.len = snap_len;
+            ok = append_frame(&out, &cap, &len, &frame, snap) == 0 && write_full(link->fd, out, len) == 0;
+            free(snap);
+            pthread_mutex_lock(&rp->lock);
+            link->sent_lsn = frame.lsn;
+            link->snapshots++;
+            pthread_mutex_unlock(&rp->lock);
+            next = frame.lsn + 1;
+            continue;
+        }
+
+        pthread_mutex_lock(&rp->lock);
+        wait_for_record(rp, next);
+        if(rp->stopping){
+            pthread_mutex_unlock(&rp->lock);
+            break;
+        }
+        frame.head_lsn = rp->lsn;
+        if(rp->lsn < next){
+            // Idle: tell the follower where we are so it can tell it's current
+            pthread_mutex_unlock(&rp->lock);
+            frame.op = REPLICA_HEARTBEAT;
+            frame.lsn = next - 1;
+            ok = append_frame(&out, &cap, &len, &frame, NULL) == 0 && write_full(link->fd, out, len) == 0;
+            continue;
+        }
+
+        // Everything new, up to a batch, in one write
+        uint64_t last = rp->lsn - next < REPLICA_BATCH ? rp->lsn : next + REPLICA_BATCH - 1;
+        uint64_t lsn = next;
+        for(; lsn <= last; lsn++){
+            ReplicaRecord *rec = &rp->backlog[lsn % REPLICA_BACKLOG];
+            if(rec->lsn != lsn || !rec->buf)
+                break;
+            frame.op = rec->op;
+            frame.lsn = rec->lsn;
+            frame.logged_ns = rec->logged_ns;
+            frame.len = rec->len;
+            if(append_frame(&out, &cap, &len, &frame, rec->buf) < 0)
+                break;
+        }
+        pthread_mutex_unlock(&rp->lock);
+        if(lsn == next){
+            // Fell a whole backlog behind, or hit a gap
+            next = 0;
+            continue;
+        }
+
+        ok = write_full(link->fd, out, len) == 0;
+        pthread_mutex_lock(&rp->lock);
+        link->sent_lsn = lsn - 1;
+        pthread_mutex_unlock(&rp->lock);
+        next = lsn;
+    }
+    free(out);
+
+    pthread_mutex_lock(&rp->lock);
+    int stopping = rp->stopping;
+    close(link->fd);
+    link->fd = -1;
+    link->active = 0;
+    pthread_mutex_unlock(&rp->lock);
+    if(!stopping)
+        printf("[PRIMARY] Follower %d disconnected\n", index);
+    return NULL;
+}
+
+static void *acceptor_thread(void *arg){
+    NewsDB *news_db = (NewsDB *)arg;
+    ReplicaPrimary *rp = news_db->primary;
+    while(1){
+        int fd = accept(rp->listen_fd, NULL, NULL);
+        if(fd < 0){
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;  // listener shut down
+        }
+
+        pthread_mutex_lock(&rp->lock);
+        int index = -1;
+        for(int i = 0; i < REPLICA_MAX_FOLLOWERS && index < 0; i++)
+            if(!rp->links[i].active)
+                index = i;
+        pthread_mutex_unlock(&rp->lock);
+        if(index < 0){
+            printf("[PRIMARY] Already streaming to %d followers, turning one away\n", REPLICA_MAX_FOLLOWERS);
+            close(fd);
+            continue;
+        }
+
+        // Reap the last follower on this link before reusing it
+        ReplicaLink *link = &rp->links[index];
+        if(link->started)
+            pthread_join(link->thread, NULL);
+        SenderArgs *args = malloc(sizeof(SenderArgs));
+        pthread_mutex_lock(&rp->lock);
+        if(rp->stopping || !args){
+            pthread_mutex_unlock(&rp->lock);
+            close(fd);
+            free(args);
+            link->started = 0;
+            break;
+        }
+        link->fd = fd;
+        link->active = 1;
+        link->started = 1;
+        link->sent_lsn = 0;
+        pthread_mutex_unlock(&rp->lock);
+
+        args->news_db = news_db;
+        args->link = link;
+        args->index = index;
+        // A thread, not a task: see above sender_thread
+        if(pthread_create(&link->thread, NULL, sender_thread, args) != 0){
+            perror("Error starting follower stream");
+            pthread_mutex_lock(&rp->lock);
+            close(fd);
+            link->fd = -1;
+            link->active = 0;
+            link->started = 0;
+            pthread_mutex_unlock(&rp->lock);
+            free(args);
+        }
+    }
+    return NULL;
+}
+
+// Serve the news log to followers connecting on the Unix socket at path
+int replica_primary_start(NewsDB *news_db, const char *path){
+    struct sockaddr_un addr;
+    if(strlen(path) >= sizeof(addr.sun_path)){
+        fprintf(stderr, "Replication socket path too long: %s\n", path);
+        return -1;
+    }
+    ReplicaPrimary *rp = calloc(1, sizeof(ReplicaPrimary));
+    if(!rp){
+        perror("Error starting replication");
+        return -1;
+    }
+
+    rp->listen_fd = unix_socket(path, &addr);
+    unlink(path);
+    if(rp->listen_fd < 0 || bind(rp->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+       || listen(rp->listen_fd, REPLICA_MAX_FOLLOWERS) < 0){
+        perror("Error starting replication");
+        if(rp->listen_fd >= 0)
+            close(rp->listen_fd);
+        free(rp);
+        return -1;
+    }
+
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&rp->lock, NULL);
+    pthread_cond_init(&rp->more, &cattr);
+    pthread_condattr_destroy(&cattr);
+    snprintf(rp->path, sizeof(rp->path), "%s", path);
+    for(int i = 0; i < REPLICA_MAX_FOLLOWERS; i++)
+        rp->links[i].fd = -1;
+    // Records are only numbered within one run of the primary; a follower
+    // of an earlier run starts over from a snapshot
+    rp->epoch = (latency_now_ns() ^ ((uint64_t)getpid() << 40)) | 1;
+
+    pthread_mutex_lock(&news_db->lock);
+    news_db->primary = rp;
+    pthread_mutex_unlock(&news_db->lock);
+    if(pthread_create(&rp->acceptor, NULL, acceptor_thread, news_db) != 0){
+        perror("Error starting replication");
+        pthread_mutex_lock(&news_db->lock);
+        news_db->primary = NULL;
+        pthread_mutex_unlock(&news_db->lock);
+        close(rp->listen_fd);
+        unlink(path);
+        pthread_cond_destroy(&rp->more);
+        pthread_mutex_destroy(&rp->lock);
+        free(rp);
+        return -1;
+    }
+    printf("[PRIMARY] Shipping the news log to followers on %s\n", path);
+    return 0;
+}
+
+static void apply_story(const News *news_item, void *arg){
+    ApplyState *st = (ApplyState *)arg;
+    NewsDB *news_db = st->news_db;
+    // Only new IDs: after resuming from a checkpoint older than our own log,
+    // the first records may hold stories we already have
+    if(news_item->id < news_db->next_id){
+        st->skipped++;
+        return;
+    }
+    int slot = news_db->end;
+    if(news_db->num_news == MAX_NEWS)
+        listing_invalidate(&news_db->listings, news_db->store->category[news_db->start]);
+    trend_reset_slot(&news_db->trend, slot);
+    load_news_item(news_db, news_item);
+    news_db->store->published_ns[slot] = st->published_ns;
+    listing_invalidate(&news_db->listings, news_db->store->category[slot]);
+    news_db->next_id = news_item->id + 1;
+    st->refs[st->count % MAX_NEWS].id = news_item->id;
+    st->refs[st->count % MAX_NEWS].slot = slot;
+    st->count++;
+}
+
+// Replace the ring with the parsed stories. Stories we had keep their
+// publish times; new ones come from a snapshot and get none, as they may
+// be much older than this run (caller holds lock).
+static void apply_rewrite(NewsDB *news_db, const ParsedNews *parsed, ApplyState *st){
+    int old_ids[MAX_NEWS];
+    int old_slots[MAX_NEWS];
+    uint64_t old_ns[MAX_NEWS];
+    uint8_t old_counted[MAX_NEWS];
+    int old = news_db->num_news;
+    for(int i = 0; i < old; i++){
+        int index = (news_db->start + i) % MAX_NEWS;
+        old_ids[i] = news_db->store->id[index];
+        old_slots[i] = index;
+        old_ns[i] = news_db->store->published_ns[index];
+        old_counted[i] = news_db->store->counted[index];
+    }
+
+    news_db->num_news = 0;
+    news_db->start = 0;
+    news_db->end = 0;
+    load_parsed_news(news_db, parsed);
+    news_db->next_id = 1;
+    // Surviving stories take their reads to their new slots
+    int trend_from[MAX_NEWS];
+    for(int i = 0; i < MAX_NEWS; i++)
+        trend_from[i] = -1;
+    for(int i = 0; i < news_db->num_news; i++){
+        int index = (news_db->start + i) % MAX_NEWS;
+        int id = news_db->store->id[index];
+        if(id >= news_db->next_id)
+            news_db->next_id = id + 1;
+        int j = 0;
+        while(j < old && old_ids[j] != id)
+            j++;
+        if(j < old){
+            news_db->store->published_ns[index] = old_ns[j];
+            news_db->store->counted[index] = old_counted[j];
+            trend_from[index] = old_slots[j];
+        }else{
+            st->refs[st->count % MAX_NEWS].id = id;
+            st->refs[st->count % MAX_NEWS].slot = index;
+            st->count++;
+        }
+    }
+    trend_remap(&news_db->trend, trend_from);
+    listing_invalidate_all(&news_db->listings);
+}
+
+// Apply one record from the primary and log it to our own news file, so a
+// restarted follower comes back from its checkpoint and log and only asks
+// for what it missed. Takes ownership of buf.
+static void apply_record(NewsDB *news_db, const ReplicaFrame *frame, char *buf){
+    ApplyState st;
+    st.news_db = news_db;
+    st.published_ns = frame->snapshot ? 0 : frame->logged_ns;
+    st.count = 0;
+    st.skipped = 0;
+
+    // A rewrite may be big enough to parse on the executor; do that before
+    // taking the locks, so no worker is held up behind them
+    ParsedNews *parsed = NULL;
+    if(frame->op == REPLICA_REWRITE){
+        parsed = malloc(sizeof(ParsedNews));
+        if(!parsed){
+            perror("Error applying replication record");
+            free(buf);
+            return;
+        }
+        parse_news_buffer(buf, frame->len, parsed);
+    }
+
+    pthread_mutex_lock(&news_db->rw_lock);
+    news_db->is_writing = 1;
+    pthread_mutex_lock(&news_db->lock);
+    news_write_begin(news_db);
+    if(frame->op == REPLICA_REWRITE){
+        apply_rewrite(news_db, parsed, &st);
+        news_db->log_bytes = frame->len;
+        checkpoint_note_tail(news_db, buf, frame->len);
+        news_db->last_ticket = persist_submit(&news_db->persist, PERSIST_REWRITE, buf, frame->len);
+    }else{
+        parse_news_text(buf, frame->len, apply_story, &st, NULL);
+        if(st.skipped == 0 && frame->len > 0){
+            news_db->log_bytes += frame->len;
+            checkpoint_note_tail(news_db, buf, frame->len);
+            news_db->last_ticket = persist_submit(&news_db->persist, PERSIST_APPEND, buf, frame->len);
+        }else{
+            // Partly a repeat: write out what the ring holds instead
+            free(buf);
+            if(st.count > 0)
+                news_db->last_ticket = save_news_snapshot(news_db);
+        }
+    }
+    news_db->replica_epoch = frame->epoch;
+    __atomic_store_n(&news_db->replica_lsn, frame->lsn, __ATOMIC_RELAXED);
+    news_write_end(news_db);
+    int want_checkpoint = st.count > 0
+        && __atomic_add_fetch(&news_db->checkpoint.since, st.count, __ATOMIC_RELAXED) >= CHECKPOINT_EVERY;
+    pthread_mutex_unlock(&news_db->lock);
+    news_db->is_writing = 0;
+    pthread_mutex_unlock(&news_db->rw_lock);
+    free(parsed);
+
+    int first = st.count > MAX_NEWS ? st.count - MAX_NEWS : 0;
+    for(int i = first; i < st.count; i++){
+        sem_post(&news_db->used_slots);
+        fanout_publish(&news_db->fanout, st.refs[i % MAX_NEWS]);
+    }
+    if(want_checkpoint)
+        checkpoint_start(news_db);
+}
+
+// Read whatever has arrived, first making room for at least the next
+// whole frame
+static int recv_more(int fd, RecvBuffer *rb){
+    if(rb->start > 0){
+        memmove(rb->data, rb->data + rb->start, rb->end - rb->start);
+        rb->end -= rb->start;
+        rb->start = 0;
+    }
+    size_t need = rb->end + 4096;
+    if(rb->end >= sizeof(ReplicaFrame)){
+        ReplicaFrame frame;
+        memcpy(&frame, rb->data, sizeof(frame));
+        if(frame.len <= REPLICA_MAX_RECORD && sizeof(frame) + frame.len > need)
+            need = sizeof(frame) + frame.len;
+    }
+    if(need > rb->cap){
+        size_t grown = rb->cap ? rb->cap : 65536;
+        while(grown < need)
+            grown *= 2;
+        char *p = realloc(rb->data, grown);
+        if(!p)
+            return -1;
+        rb->data = p;
+        rb->cap = grown;
+    }
+
+    ssize_t n;
+    do{
+        n = recv(fd, rb->data + rb->end, rb->cap - rb->end, 0);
+    }while(n < 0 && errno == EINTR);
+    if(n <= 0)
+        return -1;
+    rb->end += n;
+    return 0;
+}
+
+// 1 and the header if a whole frame starts at pos, 0 if it hasn't all
+// arrived yet, -1 if it isn't a frame
+static int frame_at(const RecvBuffer *rb, size_t pos, ReplicaFrame *frame){
+    if(rb->end - pos < sizeof(*frame))
+        return 0;
+    memcpy(frame, rb->data + pos, sizeof(*frame));
+    if(frame->magic != REPLICA_MAGIC || frame->len > REPLICA_MAX_RECORD)
+        return -1;
+    return rb->end - pos - sizeof(*frame) >= frame->len;
+}
+
+// Receive and apply frames until the connection drops. Of the records in
+// hand at once, a rewrite makes everything before it moot, so a follower
+// that fell behind skips straight to the newest rewrite.
+static void follow_stream(NewsDB *news_db, int fd){
+    ReplicaFollower *rf = news_db->follower;
+    ReplicaHello hello;
+    memset(&hello, 0, sizeof(hello));
+    hello.magic = REPLICA_MAGIC;
+    hello.epoch = news_db->replica_epoch;
+    hello.lsn = news_db->replica_lsn;
+    if(write_full(fd, &hello, sizeof(hello)) < 0)
+        return;
+
+    RecvBuffer rb = {NULL, 0, 0, 0};
+    int status = 0;
+    while(status >= 0 && recv_more(fd, &rb) == 0){
+        ReplicaFrame frame;
+        size_t pos = rb.start, from = rb.start;
+        uint64_t superseded = 0, records = 0;
+        while((status = frame_at(&rb, pos, &frame)) > 0){
+            if(frame.op == REPLICA_REWRITE){
+                from = pos;
+                superseded = records;
+            }
+            records += frame.op != REPLICA_HEARTBEAT;
+            pos += sizeof(frame) + frame.len;
+        }
+
+        for(size_t at = from; at < pos; at += sizeof(frame) + frame.len){
+            frame_at(&rb, at, &frame);
+            char *buf = NULL;
+            if(frame.op != REPLICA_HEARTBEAT){
+                buf = malloc(frame.len > 0 ? frame.len : 1);
+                if(!buf){
+                    status = -1;
+                    break;
+                }
+                memcpy(buf, rb.data + at + sizeof(frame), frame.len);
+                apply_record(news_db, &frame, buf);
+            }
+
+            uint64_t now = latency_now_ns();
+            pthread_mutex_lock(&rf->lock);
+            rf->primary_lsn = frame.head_lsn;
+            if(frame.head_lsn > frame.lsn && frame.head_lsn - frame.lsn > rf->max_behind)
+                rf->max_behind = frame.head_lsn - frame.lsn;
+            if(buf){
+                rf->applied++;
+                rf->snapshots += frame.snapshot;
+                rf->last_lag_ns = now > frame.logged_ns ? now - frame.logged_ns : 0;
+                latency_record(&rf->lag, rf->last_lag_ns);
+            }
+            pthread_mutex_unlock(&rf->lock);
+        }
+        pthread_mutex_lock(&rf->lock);
+        rf->superseded += superseded;
+        pthread_mutex_unlock(&rf->lock);
+        rb.start = pos;
+    }
+    free(rb.data);
+}
+
+static void *follower_thread(void *arg){
+    NewsDB *news_db = (NewsDB *)arg;
+    ReplicaFollower *rf = news_db->follower;
+    int reported = 0;
+    while(1){
+        pthread_mutex_lock(&rf->lock);
+        int stopping = rf->stopping;
+        pthread_mutex_unlock(&rf->lock);
+        if(stopping)
+            break;
+
+        struct sockaddr_un addr;
+        int fd = unix_socket(rf->path, &addr);
+        if(fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+            if(fd >= 0)
+                close(fd);
+            if(!reported)
+                printf("[FOLLOWER] Waiting for a primary on %s\n", rf->path);
+            reported = 1;
+            sleep_ms(REPLICA_RETRY_MS);
+            continue;
+        }
+
+        pthread_mutex_lock(&rf->lock);
+        if(rf->stopping){
+            pthread_mutex_unlock(&rf->lock);
+            close(fd);
+            break;
+        }
+        rf->fd = fd;
+        rf->connected = 1;
+        rf->connects++;
+        pthread_mutex_unlock(&rf->lock);
+        printf("[FOLLOWER] Connected to %s, asking for the log after record %llu\n",
+               rf->path, (unsigned long long)news_db->replica_lsn);
+
+        follow_stream(news_db, fd);
+
+        pthread_mutex_lock(&rf->lock);
+        rf->fd = -1;
+        rf->connected = 0;
+        stopping = rf->stopping;
+        pthread_mutex_unlock(&rf->lock);
+        close(fd);
+        if(stopping)
+            break;
+        printf("[FOLLOWER] Lost the primary, reconnecting\n");
+        reported = 0;
+        sleep_ms(REPLICA_RETRY_MS);
+    }
+    return NULL;
+}
+
+// Keep news_db a read-only copy of the primary serving on path. The
+// database has already come back from its own checkpoint and log; the
+// primary sends the records after the last one it had, or a snapshot.
+int replica_follow(NewsDB *news_db, const char *path){
+    struct sockaddr_un addr;
+    if(strlen(path) >= sizeof(addr.sun_path)){
+        fprintf(stderr, "Replication socket path too long: %s\n", path);
+        return -1;
+    }
+    ReplicaFollower *rf = calloc(1, sizeof(ReplicaFollower));
+    if(!rf){
+        perror("Error starting follower");
+        return -1;
+    }
+    pthread_mutex_init(&rf->lock, NULL);
+    snprintf(rf->path, sizeof(rf->path), "%s", path);
+    rf->fd = -1;
+    news_db->follower = rf;
+    // Blocks in recv between records, so a thread of its own (see above
+    // sender_thread)
+    if(pthread_create(&rf->thread, NULL, follower_thread, news_db) != 0){
+        perror("Error starting follower");
+        news_db->follower = NULL;
+        pthread_mutex_destroy(&rf->lock);
+        free(rf);
+        return -1;
+    }
+    return 0;
+}
+
+// Stop shipping or following, whichever this database does
+void replica_close(NewsDB *news_db){
+    ReplicaPrimary *rp = news_db->primary;
+    if(rp){
+        pthread_mutex_lock(&rp->lock);
+        rp->stopping = 1;
+        pthread_cond_broadcast(&rp->more);
+        for(int i = 0; i < REPLICA_MAX_FOLLOWERS; i++)
+            if(rp->links[i].active)
+                shutdown(rp->links[i].fd, SHUT_RDWR);
+        pthread_mutex_unlock(&rp->lock);
+        shutdown(rp->listen_fd, SHUT_RDWR);
+        pthread_join(rp->acceptor, NULL);
+        close(rp->listen_fd);
+        for(int i = 0; i < REPLICA_MAX_FOLLOWERS; i++)
+            if(rp->links[i].started)
+                pthread_join(rp->links[i].thread, NULL);
+
+        pthread_mutex_lock(&news_db->lock);
+        news_db->primary = NULL;
+        pthread_mutex_unlock(&news_db->lock);
+        for(int i = 0; i < REPLICA_BACKLOG; i++)
+            free(rp->backlog[i].buf);
+        unlink(rp->path);
+        pthread_cond_destroy(&rp->more);
+        pthread_mutex_destroy(&rp->lock);
+        free(rp);
+    }
+
+    ReplicaFollower *rf = news_db->follower;
+    if(rf){
+        pthread_mutex_lock(&rf->lock);
+        rf->stopping = 1;
+        if(rf->fd >= 0)
+            shutdown(rf->fd, SHUT_RDWR);
+        pthread_mutex_unlock(&rf->lock);
+        pthread_join(rf->thread, NULL);
+        news_db->follower = NULL;
+        pthread_mutex_destroy(&rf->lock);
+        free(rf);
+    }
+}
+
+void replica_show_stats(NewsDB *news_db){
+    ReplicaPrimary *rp = news_db->primary;
+    if(rp){
+        pthread_mutex_lock(&rp->lock);
+        printf("Replication: primary on %s at record %llu (backlog of %d)\n",
+               rp->path, (unsigned long long)rp->lsn, REPLICA_BACKLOG);
+        for(int i = 0; i < REPLICA_MAX_FOLLOWERS; i++)
+            if(rp->links[i].active)
+                printf("Follower %d: sent through record %llu (%llu behind), %llu snapshots\n", i,
+                       (unsigned long long)rp->links[i].sent_lsn,
+                       (unsigned long long)(rp->lsn - rp->links[i].sent_lsn),
+                       (unsigned long long)rp->links[i].snapshots);
+        pthread_mutex_unlock(&rp->lock);
+    }
+
+    ReplicaFollower *rf = news_db->follower;
+    if(rf){
+        uint64_t lsn = __atomic_load_n(&news_db->replica_lsn, __ATOMIC_RELAXED);
+        pthread_mutex_lock(&rf->lock);
+        printf("Replication: following %s (%s), applied record %llu of %llu (%llu behind, at most %llu)\n",
+               rf->path, rf->connected ? "connected" : "reconnecting", (unsigned long long)lsn,
+               (unsigned long long)rf->primary_lsn,
+               (unsigned long long)(rf->primary_lsn > lsn ? rf->primary_lsn - lsn : 0),
+               (unsigned long long)rf->max_behind);
+        if(rf->applied > 0)
+            printf("Replication lag: last %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us over %llu records "
+                   "(%llu snapshots, %llu superseded)\n",
+                   rf->last_lag_ns / 1e3, latency_percentile(&rf->lag, 0.50) / 1e3,
+                   latency_percentile(&rf->lag, 0.99) / 1e3, rf->lag.max_ns / 1e3,
+                   (unsigned long long)rf->applied, (unsigned long long)rf->snapshots,
+                   (unsigned long long)rf->superseded);
+        pthread_mutex_unlock(&rf->lock);
+    }
+}
@@ -0,0 +1,320 @@
+#include "program.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Spins on an odd sequence before checking whether the publisher died mid-write
+#define SHM_READ_RETRIES 1000
+// How long a new publisher waits for the owner lock before deciding the
+// segment is taken
+#define SHM_OWNER_WAIT_MS 100
+
+static SharedNewsSegment *segment_of(SharedRing *ring){
+    return (SharedNewsSegment *)((char *)ring - offsetof(SharedNewsSegment, ring));
+}
+
+// POSIX shared-memory names need a single leading slash
+static void shm_path(const char *name, char *path, size_t size){
+    snprintf(path, size, "%s%s", name[0] == '/' ? "" : "/", name);
+}
+
+// The publishing process holds the owner lock for as long as it runs, so
+// the lock is free, or comes back EOWNERDEAD, once it is gone
+int publisher_alive(SharedNewsSegment *seg){
+    int rc = pthread_mutex_trylock(&seg->owner_lock);
+    if(rc == EBUSY)
+        return 1;
+    if(rc == EOWNERDEAD)
+        pthread_mutex_consistent(&seg->owner_lock);
+    if(rc == 0 || rc == EOWNERDEAD)
+        pthread_mutex_unlock(&seg->owner_lock);
+    return 0;
+}
+
+// Create (or take over) the named segment and initialize news_db with its
+// ring. Only one publisher process owns a segment at a time; if the previous
+// owner died, the ring is discarded and rebuilt from the news file. Returns
+// 0, or -1 if the segment can't be used.
+int open_shared_news_db(NewsDB *news_db, const char *name){
+    char path[256];
+    shm_path(name, path, sizeof(path));
+
+    int created = 1;
+    int fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if(fd < 0 && errno == EEXIST){
+        created = 0;
+        fd = shm_open(path, O_RDWR, 0);
+    }
+    if(fd < 0){
+        perror("Error opening shared memory");
+        return -1;
+    }
+
+    if(created){
+        if(ftruncate(fd, sizeof(SharedNewsSegment)) < 0){
+            perror("Error sizing shared memory");
+            close(fd);
+            return -1;
+        }
+    }else{
+        struct stat st;
+        if(fstat(fd, &st) < 0){
+            perror("Error reading shared memory size");
+            close(fd);
+            return -1;
+        }
+        if((size_t)st.st_size != sizeof(SharedNewsSegment)){
+            printf("[SHM] Segment %s has an incompatible layout\n", path);
+            close(fd);
+            return -1;
+        }
+    }
+
+    SharedNewsSegment *seg = mmap(NULL, sizeof(SharedNewsSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(seg == MAP_FAILED){
+        perror("Error mapping shared memory");
+        return -1;
+    }
+
+    if(created){
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&seg->owner_lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+        seg->size = sizeof(SharedNewsSegment);
+        __atomic_store_n(&seg->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+    }else if(__atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC){
+        printf("[SHM] Segment %s was never set up; remove it and try again\n", path);
+        munmap(seg, sizeof(SharedNewsSegment));
+        return -1;
+    }
+
+    // Held until close_shared_news_db, by this thread
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += SHM_OWNER_WAIT_MS * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    int rc = pthread_mutex_timedlock(&seg->owner_lock, &deadline);
+    pid_t owner = seg->owner_pid;
+    if(rc == ETIMEDOUT){
+        printf("[SHM] Segment %s is owned by running publisher %d\n", path, (int)owner);
+        munmap(seg, sizeof(SharedNewsSegment));
+        return -1;
+    }
+    if(rc != 0 && rc != EOWNERDEAD){
+        errno = rc;
+        perror("Error locking shared memory");
+        munmap(seg, sizeof(SharedNewsSegment));
+        return -1;
+    }
+    if(rc == EOWNERDEAD)
+        pthread_mutex_consistent(&seg->owner_lock);
+    if(owner != 0)
+        printf("[SHM] Publisher %d died, taking over segment %s\n", (int)owner, path);
+    seg->owner_pid = getpid();
+
+    // Keep readers off the ring while it is rebuilt; the dead owner may also
+    // have left the sequence odd, in which case it simply stays odd until done
+    SharedRing *ring = &seg->ring;
+    unsigned seq = ring->seq;
+    if(!(seq & 1))
+        __atomic_store_n(&ring->seq, seq + 1, __ATOMIC_RELEASE);
+
+    init_news_db_shared(news_db, ring);
+    __atomic_store_n(&ring->start, news_db->start, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->num_news, news_db->num_news, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->seq, ring->seq + 1, __ATOMIC_RELEASE);
+
+    printf("[SHM] Publishing to shared segment %s\n", path);
+    return 0;
+}
+
+// Shut the publisher side down; the segment stays for attached readers
+void close_shared_news_db(NewsDB *news_db){
+    SharedNewsSegment *seg = segment_of(news_db->shared);
+    close_news_db(news_db);
+    seg->owner_pid = 0;
+    pthread_mutex_unlock(&seg->owner_lock);
+    munmap(seg, sizeof(SharedNewsSegment));
+}
+
+// Map an existing segment for a subscriber process: the header read-write
+// for the owner lock, the ring read-only
+SharedNewsSegment *attach_shared_news(const char *name){
+    char path[256];
+    shm_path(name, path, sizeof(path));
+
+    int fd = shm_open(path, O_RDWR, 0);
+    if(fd < 0){
+        perror("Error opening shared memory");
+        return NULL;
+    }
+    struct stat st;
+    if(fstat(fd, &st) < 0 || (size_t)st.st_size != sizeof(SharedNewsSegment)){
+        printf("[SHM] Segment %s is missing or has an incompatible layout\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    SharedNewsSegment *seg = mmap(NULL, sizeof(SharedNewsSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(seg == MAP_FAILED){
+        perror("Error mapping shared memory");
+        return NULL;
+    }
+    if(mprotect(&seg->ring, sizeof(SharedNewsSegment) - offsetof(SharedNewsSegment, ring), PROT_READ) < 0){
+        perror("Error protecting shared memory");
+        munmap(seg, sizeof(SharedNewsSegment));
+        return NULL;
+    }
+    if(__atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC){
+        printf("[SHM] Segment %s has not been initialized by a publisher\n", path);
+        munmap(seg, sizeof(SharedNewsSegment));
+        return NULL;
+    }
+    return seg;
+}
+
+void detach_shared_news(SharedNewsSegment *seg){
+    munmap(seg, sizeof(SharedNewsSegment));
+}
+
+// Walk the ring in place under the seqlock. If a write races the walk,
+// restart() is called and the walk is repeated, so visit() must only build
+// up state that restart() resets. Returns the number of stories visited, or
+// -1 if the publisher died in the middle of an update.
+int read_shared_news(SharedNewsSegment *seg, void (*visit)(const NewsStore *store, int slot, void *arg), void (*restart)(void *arg), void *arg){
+    const SharedRing *ring = &seg->ring;
+
+    for(int attempt = 0; ; attempt++){
+        unsigned seq = __atomic_load_n(&ring->seq, __ATOMIC_ACQUIRE);
+        if(seq & 1){
+            if(attempt >= SHM_READ_RETRIES && !publisher_alive(seg))
+                return -1;
+            sched_yield();
+            continue;
+        }
+
+        int start = __atomic_load_n(&ring->start, __ATOMIC_RELAXED);
+        int count = __atomic_load_n(&ring->num_news, __ATOMIC_RELAXED);
+        if(start >= 0 && start < MAX_NEWS && count >= 0 && count <= MAX_NEWS){
+            if(restart)
+                restart(arg);
+            for(int i = 0; i < count; i++)
+                visit(&ring->store, (start + i) % MAX_NEWS, arg);
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&ring->seq, __ATOMIC_RELAXED) == seq)
+            return count;
+    }
+}
+
+typedef struct {
+    const char *category;
+    char buf[MAX_NEWS * (MAX_LINE * 2 + 128)];
+    size_t len;
+} SharedListing;
+
+static void listing_restart(void *arg){
+    SharedListing *listing = arg;
+    listing->len = 0;
+    listing->buf[0] = '\0';
+}
+
+// Format straight out of shared memory into a local listing. A racing
+// write can leave a field unterminated, so every string read is bounded.
+static void listing_visit(const NewsStore *store, int slot, void *arg){
+    SharedListing *listing = arg;
+    uint32_t base = (uint32_t)slot * STORY_TEXT_SIZE;
+    uint32_t offs[3] = {store->category_off[slot], store->title_off[slot], store->content_off[slot]};
+    for(int i = 0; i < 3; i++)
+        if(offs[i] < base || offs[i] >= base + STORY_TEXT_SIZE)
+            return;  // torn; the seqlock check repeats the walk
+    const char *category = store->text + offs[0];
+    int category_len = (int)strnlen(category, base + STORY_TEXT_SIZE - offs[0]);
+    if(listing->category && (category_len != (int)strlen(listing->category) || memcmp(category, listing->category, category_len) != 0))
+        return;
+
+    char time_str[32];
+    struct tm tm_info;
+    time_t timestamp = store->timestamp[slot];
+    localtime_r(&timestamp, &tm_info);
+    strftime(time_str, sizeof(time_str), "%a %b %d %H:%M:%S %Y", &tm_info);
+
+    int n = snprintf(listing->buf + listing->len, sizeof(listing->buf) - listing->len,
+                     "\nID: %d\nCategory: %.*s\nTime: %s\nTitle: %.*s\nContent: %.*s\n-------------------\n",
+                     store->id[slot], category_len, category, time_str,
+                     (int)strnlen(store->text + offs[1], base + STORY_TEXT_SIZE - offs[1]), store->text + offs[1],
+                     (int)strnlen(store->text + offs[2], base + STORY_TEXT_SIZE - offs[2]), store->text + offs[2]);
+    if(n > 0)
+        listing->len += (size_t)n < sizeof(listing->buf) - listing->len ? (size_t)n : sizeof(listing->buf) - listing->len - 1;
+}
+
+static void show_shared_listing(SharedNewsSegment *seg, const char *category){
+    static __thread SharedListing listing;
+    listing.category = category;
+    int count = read_shared_news(seg, listing_visit, listing_restart, &listing);
+
+    if(count < 0){
+        printf("[SUBSCRIBER] Publisher died mid-update, data unavailable until it restarts\n");
+        return;
+    }
+    fwrite(listing.buf, 1, listing.len, stdout);
+    if(listing.len == 0)
+        printf(category ? "No news found in this category\n" : "No news available\n");
+    if(!publisher_alive(seg))
+        printf("[SUBSCRIBER] Publisher is offline, showing last published state\n");
+}
+
+// Read-only subscriber running in its own process against a shared segment
+void *shared_subscriber_thread(void *arg){
+    SharedNewsSegment *seg = (SharedNewsSegment *)arg;
+    int choice;
+
+    while(1){
+        printf("\n=== Shared Subscriber Menu ===\n");
+        printf("1. View by category\n");
+        printf("2. Show all\n");
+        printf("3. Back\n");
+        printf("Choice: ");
+
+        if(scanf("%d", &choice) != 1)
+            return NULL;
+        getchar();
+
+        switch(choice){
+        case 1:
+            printf("\nCategories:\n");
+            for(int i=0; i<NUM_CATEGORIES; i++)
+                printf("%d. %s\n", i + 1, news_categories[i]);
+            printf("Category (1-%d): ", NUM_CATEGORIES);
+            int category;
+            scanf("%d", &category);
+            getchar();
+            if(category >= 1 && category <= NUM_CATEGORIES)
+                show_shared_listing(seg, news_categories[category - 1]);
+            else
+                printf("Invalid category\n");
+            break;
+
+        case 2:
+            printf("\n=== All News ===\n");
+            show_shared_listing(seg, NULL);
+            break;
+
+        case 3:
+            return NULL;
+
+        default:
+            printf("Invalid choice\n");
+        }
+    }
+}
@@ -0,0 +1,108 @@
+#include "program.h"
+
+// Scans compare this many entries per step with no early exit, a fixed trip
+// count the compiler turns into vector compares
+#define SCAN_BLOCK 16
+
+// Index of a known category, or CATEGORY_OTHER
+uint8_t news_category_index(const char *name){
+    for(int i = 0; i < NUM_CATEGORIES; i++)
+        if(strcmp(name, news_categories[i]) == 0)
+            return (uint8_t)i;
+    return CATEGORY_OTHER;
+}
+
+static uint32_t put_text(char *dst, const char *src, size_t size){
+    size_t len = strnlen(src, size - 1);
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+    return (uint32_t)len + 1;
+}
+
+// Write a story into a ring slot: metadata into the dense arrays, text into
+// the slot's share of the heap
+void store_put(NewsStore *store, int slot, const News *news_item){
+    uint32_t off = (uint32_t)slot * STORY_TEXT_SIZE;
+    store->id[slot] = news_item->id;
+    store->category[slot] = news_category_index(news_item->category);
+    store->timestamp[slot] = news_item->timestamp;
+    store->published_ns[slot] = 0;
+    store->counted[slot] = 0;
+    store->category_off[slot] = off;
+    off += put_text(store->text + off, news_item->category, sizeof(news_item->category));
+    store->title_off[slot] = off;
+    off += put_text(store->text + off, news_item->title, sizeof(news_item->title));
+    store->content_off[slot] = off;
+    put_text(store->text + off, news_item->content, sizeof(news_item->content));
+}
+
+// Reassemble the story in a slot
+void store_get(const NewsStore *store, int slot, News *out){
+    out->id = store->id[slot];
+    out->timestamp = store->timestamp[slot];
+    put_text(out->category, store_category(store, slot), sizeof(out->category));
+    put_text(out->title, store_title(store, slot), sizeof(out->title));
+    put_text(out->content, store_content(store, slot), sizeof(out->content));
+}
+
+// Move the story in slot src to slot dst, text and all
+void store_move(NewsStore *store, int dst, int src){
+    uint32_t src_base = (uint32_t)src * STORY_TEXT_SIZE;
+    uint32_t dst_base = (uint32_t)dst * STORY_TEXT_SIZE;
+    store->id[dst] = store->id[src];
+    store->category[dst] = store->category[src];
+    store->timestamp[dst] = store->timestamp[src];
+    store->published_ns[dst] = store->published_ns[src];
+    store->counted[dst] = store->counted[src];
+    store->category_off[dst] = store->category_off[src] - src_base + dst_base;
+    store->title_off[dst] = store->title_off[src] - src_base + dst_base;
+    store->content_off[dst] = store->content_off[src] - src_base + dst_base;
+    memcpy(store->text + dst_base, store->text + src_base, STORY_TEXT_SIZE);
+}
+
+const char *store_category(const NewsStore *store, int slot){
+    return store->text + store->category_off[slot];
+}
+
+const char *store_title(const NewsStore *store, int slot){
+    return store->text + store->title_off[slot];
+}
+
+const char *store_content(const NewsStore *store, int slot){
+    return store->text + store->content_off[slot];
+}
+
+// Set match[i] for every entry in category cat; returns how many matched
+size_t scan_category(const uint8_t *restrict categories, size_t n, uint8_t cat, uint8_t *restrict match){
+    size_t hits = 0, i = 0;
+    for(; i + SCAN_BLOCK <= n; i += SCAN_BLOCK){
+        uint8_t block_hits = 0;
+        for(int j = 0; j < SCAN_BLOCK; j++){
+            uint8_t hit = categories[i + j] == cat;
+            match[i + j] = hit;
+            block_hits += hit;
+        }
+        hits += block_hits;
+    }
+    for(; i < n; i++){
+        match[i] = categories[i] == cat;
+        hits += match[i];
+    }
+    return hits;
+}
+
+// First index at or after from holding id, or -1
+long scan_find_id(const int *ids, size_t n, size_t from, int id){
+    size_t i = from;
+    for(; i + SCAN_BLOCK <= n; i += SCAN_BLOCK){
+        int any = 0;
+        for(int j = 0; j < SCAN_BLOCK; j++)
+            any |= ids[i + j] == id;
+        if(any)
+            break;
+    }
+    for(; i < n; i++)
+        if(ids[i] == id)
+            return (long)i;
+    return -1;
+}
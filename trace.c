@@ -0,0 +1,544 @@
+#include "program.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// Trace file: "NTRC" + version byte + varint next ID + the dedup table as
+// (index + 1, entry, seen) varint triples ending with a 0, then records of
+//   varint delta_us (since the previous record), op byte, payload
+// where payload fields are varints and length-prefixed strings.
+#define TRACE_MAGIC "NTRC"
+#define TRACE_VERSION 2
+
+typedef enum {
+    TRACE_LOAD = 1,
+    TRACE_PUBLISH,
+    TRACE_EDIT,
+    TRACE_READ_CATEGORY,
+    TRACE_READ_ALL,
+    TRACE_READ_STORY,
+    TRACE_RELOAD,
+    TRACE_EVICT,
+    TRACE_NUM_OPS
+} TraceOp;
+
+static const char *trace_op_names[TRACE_NUM_OPS] = {
+    "", "load", "publish", "edit", "read_category", "read_all", "read_story", "reload", "evict"
+};
+
+typedef struct {
+    FILE *file;
+    pthread_mutex_t lock;
+    uint64_t last_us;
+    uint64_t start_ns;
+} TraceRecorder;
+
+static TraceRecorder *recorder = NULL;
+
+// Records in flight, so trace_stop can wait for them before freeing the
+// recorder; trace_stop sets stopping to be told when the count hits zero
+static int trace_users = 0;
+static int trace_stopping = 0;
+static pthread_mutex_t stop_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t users_done = PTHREAD_COND_INITIALIZER;
+
+static uint64_t mono_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void put_varint(FILE *file, uint64_t value){
+    unsigned char buf[10];
+    int n = 0;
+    do{
+        buf[n] = value & 0x7f;
+        value >>= 7;
+        if(value)
+            buf[n] |= 0x80;
+        n++;
+    }while(value);
+    fwrite(buf, 1, n, file);
+}
+
+static void put_string(FILE *file, const char *s){
+    size_t len = strlen(s);
+    put_varint(file, len);
+    fwrite(s, 1, len, file);
+}
+
+static void release_user(void){
+    if(__atomic_sub_fetch(&trace_users, 1, __ATOMIC_SEQ_CST) == 0
+       && __atomic_load_n(&trace_stopping, __ATOMIC_SEQ_CST)){
+        pthread_mutex_lock(&stop_lock);
+        pthread_cond_broadcast(&users_done);
+        pthread_mutex_unlock(&stop_lock);
+    }
+}
+
+// Start a record: lock, write the time delta and op. Returns the locked
+// recorder to write the payload to, or NULL when off.
+static TraceRecorder *record_begin(TraceOp op){
+    if(!__atomic_load_n(&recorder, __ATOMIC_ACQUIRE))
+        return NULL;  // not recording: no shared counter traffic
+    __atomic_add_fetch(&trace_users, 1, __ATOMIC_SEQ_CST);
+    TraceRecorder *rec = __atomic_load_n(&recorder, __ATOMIC_SEQ_CST);
+    if(!rec){
+        release_user();
+        return NULL;
+    }
+    pthread_mutex_lock(&rec->lock);
+    uint64_t now_us = (mono_ns() - rec->start_ns) / 1000;
+    if(now_us < rec->last_us)
+        now_us = rec->last_us;
+    put_varint(rec->file, now_us - rec->last_us);
+    rec->last_us = now_us;
+    fputc(op, rec->file);
+    return rec;
+}
+
+static void record_end(TraceRecorder *rec){
+    pthread_mutex_unlock(&rec->lock);
+    release_user();
+}
+
+// Begin recording to path; the stories already in the buffer are written
+// first so a replay starts from the same state
+int trace_start(const char *path, NewsDB *news_db){
+    TraceRecorder *rec = calloc(1, sizeof(TraceRecorder));
+    rec->file = fopen(path, "wb");
+    if(!rec->file){
+        perror("Error creating trace file");
+        free(rec);
+        return -1;
+    }
+    pthread_mutex_init(&rec->lock, NULL);
+    fwrite(TRACE_MAGIC, 1, 4, rec->file);
+    fputc(TRACE_VERSION, rec->file);
+
+    // Evictions and dropped batch stories can leave the next ID well past
+    // the newest story loaded, so the replay starts from it too
+    // Likewise the stories dedup still remembers, evicted ones included
+    pthread_mutex_lock(&news_db->lock);
+    put_varint(rec->file, (uint32_t)news_db->next_id);
+    uint64_t entry, seen;
+    for(int i = 0; i < DEDUP_TABLE_SIZE; i++){
+        if(!dedup_get_entry(&news_db->dedup, i, &entry, &seen))
+            continue;
+        put_varint(rec->file, i + 1);
+        put_varint(rec->file, entry);
+        put_varint(rec->file, seen);
+    }
+    put_varint(rec->file, 0);
+    rec->start_ns = mono_ns();
+    for(int i = 0; i < news_db->num_news; i++){
+        int index = (news_db->start + i) % MAX_NEWS;
+        put_varint(rec->file, 0);
+        fputc(TRACE_LOAD, rec->file);
+        put_varint(rec->file, news_db->store->id[index]);
+        put_varint(rec->file, (uint64_t)news_db->store->timestamp[index]);
+        put_string(rec->file, store_category(news_db->store, index));
+        put_string(rec->file, store_title(news_db->store, index));
+        put_string(rec->file, store_content(news_db->store, index));
+    }
+    __atomic_store_n(&recorder, rec, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&news_db->lock);
+
+    printf("[TRACE] Recording to %s\n", path);
+    return 0;
+}
+
+// Stop recording once the records already under way are written
+void trace_stop(void){
+    __atomic_store_n(&trace_stopping, 1, __ATOMIC_SEQ_CST);
+    TraceRecorder *rec = __atomic_exchange_n(&recorder, NULL, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&stop_lock);
+    while(__atomic_load_n(&trace_users, __ATOMIC_SEQ_CST) > 0)
+        pthread_cond_wait(&users_done, &stop_lock);
+    pthread_mutex_unlock(&stop_lock);
+    __atomic_store_n(&trace_stopping, 0, __ATOMIC_SEQ_CST);
+    if(!rec)
+        return;
+    fclose(rec->file);
+    pthread_mutex_destroy(&rec->lock);
+    free(rec);
+}
+
+void trace_publish(int id, const char *category, const char *title, const char *content, int writer_id){
+    TraceRecorder *rec = record_begin(TRACE_PUBLISH);
+    if(!rec)
+        return;
+    put_varint(rec->file, (uint32_t)id);
+    put_varint(rec->file, (uint32_t)writer_id);
+    put_string(rec->file, category);
+    put_string(rec->file, title);
+    put_string(rec->file, content);
+    record_end(rec);
+}
+
+void trace_edit(int id, const char *title, const char *content, int category){
+    TraceRecorder *rec = record_begin(TRACE_EDIT);
+    if(!rec)
+        return;
+    put_varint(rec->file, (uint32_t)id);
+    put_varint(rec->file, (uint32_t)category);
+    put_string(rec->file, title);
+    put_string(rec->file, content);
+    record_end(rec);
+}
+
+void trace_read_category(const char *category){
+    TraceRecorder *rec = record_begin(TRACE_READ_CATEGORY);
+    if(!rec)
+        return;
+    put_string(rec->file, category);
+    record_end(rec);
+}
+
+void trace_read_all(void){
+    TraceRecorder *rec = record_begin(TRACE_READ_ALL);
+    if(rec)
+        record_end(rec);
+}
+
+void trace_read_story(StoryRef ref){
+    TraceRecorder *rec = record_begin(TRACE_READ_STORY);
+    if(!rec)
+        return;
+    put_varint(rec->file, (uint32_t)ref.id);
+    put_varint(rec->file, (uint32_t)ref.slot);
+    record_end(rec);
+}
+
+void trace_reload(void){
+    TraceRecorder *rec = record_begin(TRACE_RELOAD);
+    if(rec)
+        record_end(rec);
+}
+
+// manual: subscriber-requested; automatic ones happen again on their own in a replay
+void trace_evict(int manual){
+    TraceRecorder *rec = record_begin(TRACE_EVICT);
+    if(!rec)
+        return;
+    fputc(manual ? 1 : 0, rec->file);
+    record_end(rec);
+}
+
+typedef struct {
+    const unsigned char *data;
+    size_t len;
+    size_t pos;
+    int bad;
+} TraceReader;
+
+static uint64_t get_varint(TraceReader *r){
+    uint64_t value = 0;
+    for(int shift = 0; shift < 64; shift += 7){
+        if(r->pos >= r->len){
+            r->bad = 1;
+            return 0;
+        }
+        unsigned char byte = r->data[r->pos++];
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if(!(byte & 0x80))
+            return value;
+    }
+    r->bad = 1;
+    return 0;
+}
+
+// Copy a string field into out (truncated to size)
+static void get_string(TraceReader *r, char *out, size_t size){
+    uint64_t len = get_varint(r);
+    if(r->bad || len > r->len - r->pos){
+        r->bad = 1;
+        out[0] = '\0';
+        return;
+    }
+    size_t n = len < size - 1 ? len : size - 1;
+    memcpy(out, r->data + r->pos, n);
+    out[n] = '\0';
+    r->pos += len;
+}
+
+typedef struct {
+    uint64_t *samples;
+    size_t count;
+    size_t cap;
+} LatencySamples;
+
+static void add_sample(LatencySamples *s, uint64_t ns){
+    if(s->count == s->cap){
+        s->cap = s->cap ? s->cap * 2 : 256;
+        s->samples = realloc(s->samples, s->cap * sizeof(uint64_t));
+    }
+    s->samples[s->count++] = ns;
+}
+
+static int cmp_u64(const void *a, const void *b){
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_us(LatencySamples *s, double p){
+    if(s->count == 0)
+        return 0.0;
+    size_t index = (size_t)(p * (s->count - 1) + 0.5);
+    return s->samples[index] / 1000.0;
+}
+
+// Look a metric up in a saved report; returns 0 if missing
+static int report_value(const char *path, const char *key, double *value){
+    FILE *file = fopen(path, "r");
+    if(!file)
+        return 0;
+    char line[256];
+    size_t key_len = strlen(key);
+    int found = 0;
+    while(fgets(line, sizeof(line), file)){
+        if(strncmp(line, key, key_len) == 0 && line[key_len] == '='){
+            *value = atof(line + key_len + 1);
+            found = 1;
+            break;
+        }
+    }
+    fclose(file);
+    return found;
+}
+
+static void report_metric(FILE *report, const char *baseline, const char *key, double value){
+    if(report)
+        fprintf(report, "%s=%.3f\n", key, value);
+    double base;
+    if(baseline && report_value(baseline, key, &base) && base != 0.0)
+        printf("  %-28s %12.3f   baseline %12.3f   (%+.1f%%)\n", key, value, base, (value - base) / base * 100.0);
+    else
+        printf("  %-28s %12.3f\n", key, value);
+}
+
+static void remove_replay_dir(const char *dir){
+    char path[512];
+    const char *files[] = {NEWS_FILE, NEWS_FILE ".tmp", CHECKPOINT_FILE, CHECKPOINT_FILE ".tmp", CATEGORY_FILE};
+    for(size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++){
+        snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+        remove(path);
+    }
+    rmdir(dir);
+}
+
+// Drive the operations of a trace against a scratch NewsDB, either at the
+// recorded pace or back to back, and report throughput and per-op latency.
+// With baseline_path, each metric is compared with an earlier report.
+int replay_trace(const char *path, int fast, const char *report_path, const char *baseline_path){
+    FILE *file = fopen(path, "rb");
+    if(!file){
+        perror("Error opening trace file");
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    unsigned char *data = malloc(size > 0 ? size : 1);
+    if(fread(data, 1, size, file) != (size_t)size || size < 5 || memcmp(data, TRACE_MAGIC, 4) != 0 || data[4] != TRACE_VERSION){
+        printf("[REPLAY] %s is not a trace file\n", path);
+        fclose(file);
+        free(data);
+        return 1;
+    }
+    fclose(file);
+
+    // Resolve paths before moving into the scratch directory
+    char cwd[512], report_abs[1024] = "", baseline_abs[1024] = "";
+    if(!getcwd(cwd, sizeof(cwd))){
+        free(data);
+        return 1;
+    }
+    if(report_path)
+        snprintf(report_abs, sizeof(report_abs), "%s%s%s", report_path[0] == '/' ? "" : cwd, report_path[0] == '/' ? "" : "/", report_path);
+    if(baseline_path)
+        snprintf(baseline_abs, sizeof(baseline_abs), "%s%s%s", baseline_path[0] == '/' ? "" : cwd, baseline_path[0] == '/' ? "" : "/", baseline_path);
+
+    char dir[] = "/tmp/news-replay-XXXXXX";
+    if(!mkdtemp(dir) || chdir(dir) < 0){
+        perror("Error creating replay directory");
+        free(data);
+        return 1;
+    }
+
+    TraceReader r = {data, (size_t)size, 5, 0};
+    int next_id = (int)get_varint(&r);
+    size_t dedup_from = r.pos;
+    while(!r.bad && get_varint(&r) != 0){
+        get_varint(&r);
+        get_varint(&r);
+    }
+
+    // Initial buffer contents become the scratch news file
+    FILE *seed = fopen(NEWS_FILE, "w");
+    while(r.pos < r.len){
+        size_t mark = r.pos;
+        get_varint(&r);
+        if(r.pos >= r.len || r.data[r.pos] != TRACE_LOAD){
+            r.pos = mark;
+            break;
+        }
+        r.pos++;
+        News news_item;
+        news_item.id = (int)get_varint(&r);
+        news_item.timestamp = (time_t)get_varint(&r);
+        get_string(&r, news_item.category, sizeof(news_item.category));
+        get_string(&r, news_item.title, sizeof(news_item.title));
+        get_string(&r, news_item.content, sizeof(news_item.content));
+        char time_str[32];
+        struct tm tm_info;
+        localtime_r(&news_item.timestamp, &tm_info);
+        strftime(time_str, sizeof(time_str), "%a %b %d %H:%M:%S %Y", &tm_info);
+        fprintf(seed, "%d|%s|%s|%s|%s\n", news_item.id, news_item.category, news_item.title, news_item.content, time_str);
+    }
+    fclose(seed);
+
+    // The store's own console output would swamp the report; send it away
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+
+    static NewsDB news_db;
+    init_news_db(&news_db);
+    if(next_id > news_db.next_id)
+        news_db.next_id = next_id;
+    // Dedup as recorded, so repeats of stories evicted before the trace
+    // started are still caught
+    size_t resume = r.pos;
+    memset(news_db.dedup.entries, 0, sizeof(news_db.dedup.entries));
+    memset(news_db.dedup.seen, 0, sizeof(news_db.dedup.seen));
+    for(r.pos = dedup_from; ; ){
+        uint64_t index = get_varint(&r);
+        if(index == 0 || r.bad)
+            break;
+        uint64_t entry = get_varint(&r);
+        dedup_set_entry(&news_db.dedup, (int)(index - 1), entry, get_varint(&r));
+    }
+    r.pos = resume;
+    ratelimit_set(&news_db.limits, 0, 0);  // the trace already holds the admitted stream
+
+    LatencySamples lat[TRACE_NUM_OPS];
+    memset(lat, 0, sizeof(lat));
+    uint64_t ops = 0, skipped = 0, id_mismatches = 0, trace_us = 0;
+    static char category[MAX_LINE], title[MAX_LINE], content[MAX_LINE];
+    uint64_t replay_start = mono_ns();
+
+    while(r.pos < r.len && !r.bad){
+        trace_us += get_varint(&r);
+        if(r.pos >= r.len)
+            break;
+        TraceOp op = (TraceOp)r.data[r.pos++];
+
+        if(!fast){
+            uint64_t elapsed_us = (mono_ns() - replay_start) / 1000;
+            if(trace_us > elapsed_us){
+                struct timespec pause = {(time_t)((trace_us - elapsed_us) / 1000000), (long)((trace_us - elapsed_us) % 1000000) * 1000};
+                nanosleep(&pause, NULL);
+            }
+        }
+
+        uint64_t t0 = mono_ns();
+        switch(op){
+        case TRACE_PUBLISH: {
+            int id = (int)get_varint(&r);
+            int writer_id = (int)get_varint(&r);
+            get_string(&r, category, sizeof(category));
+            get_string(&r, title, sizeof(title));
+            get_string(&r, content, sizeof(content));
+            t0 = mono_ns();
+            if(add_news(&news_db, category, title, content, writer_id) != id)
+                id_mismatches++;
+            break;
+        }
+        case TRACE_EDIT: {
+            int id = (int)get_varint(&r);
+            int new_category = (int)get_varint(&r);
+            get_string(&r, title, sizeof(title));
+            get_string(&r, content, sizeof(content));
+            t0 = mono_ns();
+            apply_news_edit(&news_db, id, title, content, new_category);
+            break;
+        }
+        case TRACE_READ_CATEGORY:
+            get_string(&r, category, sizeof(category));
+            t0 = mono_ns();
+            show_news_by_category(&news_db, category);
+            break;
+        case TRACE_READ_ALL:
+            show_all_news(&news_db);
+            break;
+        case TRACE_READ_STORY: {
+            StoryRef ref;
+            ref.id = (int)get_varint(&r);
+            ref.slot = (int)get_varint(&r);
+            News news_item;
+            t0 = mono_ns();
+            read_story_ref(&news_db, ref, &news_item);
+            break;
+        }
+        case TRACE_RELOAD:
+            reload_news_db(&news_db);
+            break;
+        case TRACE_EVICT:
+            if(r.pos >= r.len || !r.data[r.pos++]){
+                skipped++; // automatic, add_news evicts again by itself
+                continue;
+            }
+            remove_oldest_if_full(&news_db);
+            break;
+        default:
+            r.bad = 1;
+            continue;
+        }
+        add_sample(&lat[op], mono_ns() - t0);
+        ops++;
+    }
+    double wall_ms = (mono_ns() - replay_start) / 1e6;
+
+    close_news_db(&news_db);
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    if(chdir(cwd) < 0)
+        perror("Error returning to working directory");
+    remove_replay_dir(dir);
+
+    if(r.bad)
+        printf("[REPLAY] Warning: trace is truncated or corrupt, replayed what was readable\n");
+
+    FILE *report = report_path ? fopen(report_abs, "w") : NULL;
+    printf("\n=== Replay of %s (%s) ===\n", path, fast ? "as fast as possible" : "original pace");
+    report_metric(report, baseline_path ? baseline_abs : NULL, "ops", (double)ops);
+    report_metric(report, baseline_path ? baseline_abs : NULL, "wall_ms", wall_ms);
+    report_metric(report, baseline_path ? baseline_abs : NULL, "ops_per_sec", wall_ms > 0 ? ops / (wall_ms / 1000.0) : 0.0);
+    report_metric(report, baseline_path ? baseline_abs : NULL, "id_mismatches", (double)id_mismatches);
+    for(int op = TRACE_PUBLISH; op < TRACE_NUM_OPS; op++){
+        if(lat[op].count == 0)
+            continue;
+        qsort(lat[op].samples, lat[op].count, sizeof(uint64_t), cmp_u64);
+        char key[64];
+        snprintf(key, sizeof(key), "%s.count", trace_op_names[op]);
+        report_metric(report, baseline_path ? baseline_abs : NULL, key, (double)lat[op].count);
+        snprintf(key, sizeof(key), "%s.p50_us", trace_op_names[op]);
+        report_metric(report, baseline_path ? baseline_abs : NULL, key, percentile_us(&lat[op], 0.50));
+        snprintf(key, sizeof(key), "%s.p99_us", trace_op_names[op]);
+        report_metric(report, baseline_path ? baseline_abs : NULL, key, percentile_us(&lat[op], 0.99));
+        snprintf(key, sizeof(key), "%s.max_us", trace_op_names[op]);
+        report_metric(report, baseline_path ? baseline_abs : NULL, key, percentile_us(&lat[op], 1.0));
+        free(lat[op].samples);
+    }
+    printf("  (%llu automatic evictions not replayed directly)\n", (unsigned long long)skipped);
+    if(report){
+        fclose(report);
+        printf("[REPLAY] Report written to %s\n", report_path);
+    }
+
+    free(data);
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include "program.h"
+
+void trend_init(TrendTable *trend){
+    memset(trend->counts, 0, sizeof(trend->counts));
+}
+
+// A new story took this slot; forget the old one's reads (caller holds lock)
+void trend_reset_slot(TrendTable *trend, int slot){
+    memset(trend->counts[slot], 0, sizeof(trend->counts[slot]));
+}
+
+// The story in slot src now lives in dst; its reads go with it (caller holds lock)
+void trend_move_slot(TrendTable *trend, int dst, int src){
+    memcpy(trend->counts[dst], trend->counts[src], sizeof(trend->counts[dst]));
+}
+
+// Stories changed slots all at once: slot i takes the reads of slot from[i],
+// or starts from zero when from[i] < 0. Works from a copy, as the moves can
+// chase each other round the ring (caller holds lock).
+void trend_remap(TrendTable *trend, const int *from){
+    TrendTable before = *trend;
+    for(int slot = 0; slot < MAX_NEWS; slot++){
+        if(from[slot] >= 0)
+            memcpy(trend->counts[slot], before.counts[from[slot]], sizeof(trend->counts[slot]));
+        else
+            memset(trend->counts[slot], 0, sizeof(trend->counts[slot]));
+    }
+}
+
+// Current bucket epoch; a listing takes it once for all the stories it shows
+uint32_t trend_epoch(void){
+    return (uint32_t)(time(NULL) / TREND_BUCKET_SECS);
+}
+
+// Count one read of the story in slot. Every reader already holds the store
+// lock, so this is a plain compare and increment (caller holds lock).
+void trend_record(TrendTable *trend, int slot, uint32_t epoch){
+    uint64_t *counter = &trend->counts[slot][epoch % TREND_BUCKETS];
+    if((uint32_t)(*counter >> 32) == epoch)
+        (*counter)++;
+    else
+        *counter = (uint64_t)epoch << 32 | 1;  // first read since the bucket wrapped round
+}
+
+// Reads of the story in slot over the last window_buckets buckets (caller
+// holds lock)
+uint64_t trend_reads(const TrendTable *trend, int slot, int window_buckets){
+    uint32_t now = trend_epoch();
+    if(window_buckets > TREND_BUCKETS)
+        window_buckets = TREND_BUCKETS;
+
+    uint64_t reads = 0;
+    for(int b = 0; b < TREND_BUCKETS; b++){
+        uint64_t value = trend->counts[slot][b];
+        if(now - (uint32_t)(value >> 32) < (uint32_t)window_buckets)
+            reads += (uint32_t)value;
+    }
+    return reads;
+}
+
+// Up to k most-read stories in category over the last window_minutes,
+// most read first. Returns how many were filled in.
+int trend_top(NewsDB *news_db, const char *category, int window_minutes, TrendEntry *top, int k){
+    int window_buckets = (window_minutes * 60 + TREND_BUCKET_SECS - 1) / TREND_BUCKET_SECS;
+    uint8_t cat = news_category_index(category);
+    uint8_t match[MAX_NEWS];
+    int found = 0;
+
+    pthread_mutex_lock(&news_db->lock);
+    scan_category(news_db->store->category, MAX_NEWS, cat, match);
+    for(int i = 0; i < news_db->num_news; i++){
+        int slot = (news_db->start + i) % MAX_NEWS;
+        if(!match[slot] || (cat == CATEGORY_OTHER && strcmp(store_category(news_db->store, slot), category) != 0))
+            continue;
+        uint64_t reads = trend_reads(&news_db->trend, slot, window_buckets);
+        if(reads == 0)
+            continue;
+
+        // Insertion into the short sorted list
+        int pos = found < k ? found++ : k;
+        while(pos > 0 && top[pos - 1].reads < reads){
+            if(pos < k)
+                top[pos] = top[pos - 1];
+            pos--;
+        }
+        if(pos < k){
+            top[pos].id = news_db->store->id[slot];
+            top[pos].slot = slot;
+            top[pos].reads = reads;
+            snprintf(top[pos].title, sizeof(top[pos].title), "%s", store_title(news_db->store, slot));
+        }
+    }
+    pthread_mutex_unlock(&news_db->lock);
+    return found;
+}
+
+void show_trending(NewsDB *news_db, const char *category){
+    TrendEntry top[TREND_TOP_K];
+    int count = trend_top(news_db, category, TREND_WINDOW_MINUTES, top, TREND_TOP_K);
+
+    printf("\n=== Most read in %s (last %d minutes) ===\n", category, TREND_WINDOW_MINUTES);
+    for(int i = 0; i < count; i++)
+        printf("%d. [ID %d] %s - %llu reads\n", i + 1, top[i].id, top[i].title,
+               (unsigned long long)top[i].reads);
+    if(count == 0)
+        printf("No reads in this category yet\n");
+}